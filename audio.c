@@ -0,0 +1,512 @@
+/*
+ * audio.c: streaming audio spectrum analyser for the 010 mode
+ *
+ * A reader thread pulls PCM in hops of AUDIO_HOP frames, slides them into
+ * a window of AUDIO_FFT_SIZE samples and runs a radix-2 FFT on it.  The
+ * FFT keeps real and imaginary parts in separate arrays and precomputes
+ * the twiddles of every stage contiguously, so the butterfly loop is a
+ * plain unit-stride loop the compiler can vectorise.
+ *
+ * Band energies are mapped onto the five data registers as bar graphs and
+ * onto the operation LED column as beat flags.  The result is handed to
+ * the show() callback straight from the reader thread, so an LED changes
+ * at most one hop (64 samples, 1.5ms at 44.1kHz) plus one FFT after the
+ * sample arrived, which is less than one multiplex refresh period.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "delay.h"
+#include "log.h"
+
+#define FFT_N		AUDIO_FFT_SIZE
+#define BINS		(FFT_N / 2)
+
+#define DB_RANGE	48.0f	// dB shown by a full bar
+#define DB_PER_LED	(DB_RANGE / 12)
+#define DB_MIN_CEIL	-50.0f	// don't amplify silence beyond this
+#define CEIL_DECAY	0.005f	// dB per window the automatic gain recovers
+#define BAR_FALL	0.25f	// LEDs per window a bar may fall
+#define BEAT_RATIO	1.8f	// band energy vs. running average for a beat
+#define BEAT_HOLD_MS	50	// keep a beat flag lit this long
+
+struct audio_state {
+	int   rate;
+	float hist[FFT_N];		// newest FFT_N mono samples, oldest first
+	float re[FFT_N];
+	float im[FFT_N];
+	float ceiling;			// loudest recent band (dB), automatic gain
+	float level[AUDIO_BARS];	// bar height in LEDs, 0..12
+	float beat_avg[AUDIO_BEATS];	// running average energy per beat band
+	int   beat_hold[AUDIO_BEATS];	// windows left to show a beat
+	int   hold_windows;
+	int   bar_edge[AUDIO_BARS + 1];	// FFT bin ranges of the bands
+	int   beat_edge[AUDIO_BEATS + 1];
+};
+
+// Tables shared by all analysers, built once by fft_init()
+static float    window[FFT_N];		// Hann window
+static float    tw_re[FFT_N];		// twiddles of stage h at [h, 2h)
+static float    tw_im[FFT_N];
+static uint16_t bitrev[FFT_N];
+static pthread_once_t fft_once = PTHREAD_ONCE_INIT;
+
+static struct {
+	const char *path;
+	int  fd;
+	int  rate;
+	int  channels;
+	int  paced;			// regular file: replay at the sample rate
+	off_t data_start;		// first PCM byte of a regular file
+	unsigned char pre[4];		// bytes read while probing for a header
+	int  pre_len;
+	volatile int running;
+	volatile int active;
+	void (*show)(const struct audio_frame *frame);
+	pthread_t thread;
+} audio = { .fd = -1 };
+
+
+// PART 1 - FFT and band analysis --------------------------------------
+
+static void fft_init(void)
+{
+	int i, h, j, bits;
+
+	for (i = 0; i < FFT_N; i++)
+		window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / FFT_N);
+
+	for (bits = 0; (1 << bits) < FFT_N; bits++)
+		;
+	for (i = 0; i < FFT_N; i++)
+	{
+		int r = 0;
+		for (j = 0; j < bits; j++)
+			if (i & (1 << j))
+				r |= 1 << (bits - 1 - j);
+		bitrev[i] = r;
+	}
+
+	for (h = 1; h < FFT_N; h <<= 1)
+		for (j = 0; j < h; j++)
+		{
+			tw_re[h + j] =  cosf((float)M_PI * j / h);
+			tw_im[h + j] = -sinf((float)M_PI * j / h);
+		}
+}
+
+// In-place decimation in time FFT, input already in bit reversed order
+static void fft_run(float *restrict re, float *restrict im)
+{
+	int h, k, j;
+
+	for (h = 1; h < FFT_N; h <<= 1)
+		for (k = 0; k < FFT_N; k += 2 * h)
+		{
+			float *restrict ar = re + k;
+			float *restrict ai = im + k;
+			float *restrict br = re + k + h;
+			float *restrict bi = im + k + h;
+			const float *restrict wr = tw_re + h;
+			const float *restrict wi = tw_im + h;
+
+			for (j = 0; j < h; j++)
+			{
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] = ar[j] + tr;
+				ai[j] = ai[j] + ti;
+			}
+		}
+}
+
+// Split 60Hz..16kHz into log spaced bands of at least one FFT bin each
+static void band_edges(int *edge, int bands, int rate)
+{
+	float lo = 60.0f;
+	float hi = rate / 2.0f;
+	int i, bin;
+
+	if (hi > 16000.0f)
+		hi = 16000.0f;
+	for (i = 0; i <= bands; i++)
+	{
+		bin = (int)(lo * powf(hi / lo, (float)i / bands) * FFT_N / rate + 0.5f);
+		if (bin < 1)
+			bin = 1;
+		if (i > 0 && bin <= edge[i - 1])
+			bin = edge[i - 1] + 1;
+		if (bin > BINS)
+			bin = BINS;
+		edge[i] = bin;
+	}
+}
+
+static void audio_state_init(struct audio_state *s, int rate)
+{
+	pthread_once(&fft_once, fft_init);
+	memset(s, 0, sizeof *s);
+	s->rate = rate;
+	s->ceiling = DB_MIN_CEIL;
+	s->hold_windows = rate * BEAT_HOLD_MS / 1000 / AUDIO_HOP;
+	if (s->hold_windows < 1)
+		s->hold_windows = 1;
+	band_edges(s->bar_edge, AUDIO_BARS, rate);
+	band_edges(s->beat_edge, AUDIO_BEATS, rate);
+}
+
+// Average power of bins [from, to), 0 dB = full scale sine
+static float band_power(const float *power, int from, int to)
+{
+	float sum = 0.0f;
+	int i;
+
+	if (to <= from)
+		return 0.0f;
+	for (i = from; i < to; i++)
+		sum += power[i];
+	return sum / (to - from);
+}
+
+// Push AUDIO_HOP interleaved frames and analyse the resulting window
+static void audio_analyse(struct audio_state *s, const int16_t *pcm, int channels,
+			  struct audio_frame *out)
+{
+	float power[BINS];
+	float scale = 1.0f / (32768.0f * channels);
+	float norm = 16.0f / ((float)FFT_N * FFT_N);	// Hann: full scale sine = 1
+	float db, loudest, target, p;
+	int i, c, n;
+
+	memmove(s->hist, s->hist + AUDIO_HOP, (FFT_N - AUDIO_HOP) * sizeof s->hist[0]);
+	for (i = 0; i < AUDIO_HOP; i++)
+	{
+		int sum = 0;
+		for (c = 0; c < channels; c++)
+			sum += pcm[i * channels + c];
+		s->hist[FFT_N - AUDIO_HOP + i] = sum * scale;
+	}
+
+	for (i = 0; i < FFT_N; i++)
+	{
+		s->re[bitrev[i]] = s->hist[i] * window[i];
+		s->im[i] = 0.0f;
+	}
+	fft_run(s->re, s->im);
+	for (i = 0; i < BINS; i++)
+		power[i] = (s->re[i] * s->re[i] + s->im[i] * s->im[i]) * norm;
+
+	// bar graphs, with automatic gain following the loudest band
+	loudest = DB_MIN_CEIL;
+	for (i = 0; i < AUDIO_BARS; i++)
+	{
+		db = 10.0f * log10f(band_power(power, s->bar_edge[i], s->bar_edge[i + 1]) + 1e-12f);
+		if (db > loudest)
+			loudest = db;
+		target = (db - (s->ceiling - DB_RANGE)) / DB_PER_LED;
+		if (target < s->level[i] - BAR_FALL)
+			target = s->level[i] - BAR_FALL;
+		if (target < 0.0f)
+			target = 0.0f;
+		if (target > 12.0f)
+			target = 12.0f;
+		s->level[i] = target;
+		n = (int)(target + 0.5f);
+		out->bars[i] = ((1 << n) - 1) << (12 - n);
+	}
+	s->ceiling -= CEIL_DECAY;
+	if (loudest > s->ceiling)
+		s->ceiling = loudest;
+
+	// beat flags: a band jumping well above its running average
+	out->beats = 0;
+	for (i = 0; i < AUDIO_BEATS; i++)
+	{
+		p = band_power(power, s->beat_edge[i], s->beat_edge[i + 1]);
+		if (p > s->beat_avg[i] * BEAT_RATIO && 10.0f * log10f(p + 1e-12f) > s->ceiling - DB_RANGE)
+			s->beat_hold[i] = s->hold_windows;
+		s->beat_avg[i] = s->beat_avg[i] * 0.98f + p * 0.02f;
+		if (s->beat_hold[i] > 0)
+		{
+			s->beat_hold[i]--;
+			out->beats |= 1 << i;
+		}
+	}
+}
+
+
+// PART 2 - PCM input --------------------------------------------------
+
+// Read exactly len bytes unless the stream ends, probed header bytes first
+static ssize_t source_read(void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	size_t done = 0;
+	ssize_t n;
+
+	if (audio.pre_len > 0)
+	{
+		done = (size_t)audio.pre_len < len ? (size_t)audio.pre_len : len;
+		memcpy(p, audio.pre, done);
+		memmove(audio.pre, audio.pre + done, audio.pre_len - done);
+		audio.pre_len -= done;
+	}
+	while (done < len)
+	{
+		n = read(audio.fd, p + done, len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static uint32_t le32(const unsigned char *b)
+{
+	return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+// Skip a WAV header if there is one and take rate and channels from it
+static int source_probe(void)
+{
+	unsigned char hdr[16];
+	uint32_t size;
+
+	audio.pre_len = 0;
+	if (source_read(hdr, 4) != 4)
+		return -1;
+	if (memcmp(hdr, "RIFF", 4) != 0)
+	{
+		memcpy(audio.pre, hdr, 4);	// raw PCM, keep the samples
+		audio.pre_len = 4;
+		return 0;
+	}
+	if (source_read(hdr, 8) != 8 || memcmp(hdr + 4, "WAVE", 4) != 0)
+		return -1;
+
+	for (;;)
+	{
+		if (source_read(hdr, 8) != 8)
+			return -1;
+		size = le32(hdr + 4);
+		if (memcmp(hdr, "data", 4) == 0)
+			break;
+		if (memcmp(hdr, "fmt ", 4) == 0 && size >= 16)
+		{
+			if (source_read(hdr, 16) != 16)
+				return -1;
+			if ((hdr[0] | hdr[1] << 8) != 1 || (hdr[14] | hdr[15] << 8) != 16)
+			{
+				log_error("audio: only 16 bit PCM WAV files are supported");
+				return -1;
+			}
+			audio.channels = hdr[2] | hdr[3] << 8;
+			audio.rate = le32(hdr + 4);
+			size -= 16;
+		}
+		size += size & 1;		// chunks are word aligned
+		while (size > 0)
+		{
+			size_t n = size > sizeof hdr ? sizeof hdr : size;
+			if (source_read(hdr, n) != (ssize_t)n)
+				return -1;
+			size -= n;
+		}
+	}
+	if (audio.channels < 1 || audio.channels > AUDIO_MAX_CHANNELS || audio.rate < 8000)
+	{
+		log_error("audio: unsupported format (%d channels, %d Hz)",
+			  audio.channels, audio.rate);
+		return -1;
+	}
+	return 0;
+}
+
+static int source_open(void)
+{
+	struct stat st;
+
+	if (strcmp(audio.path, "-") == 0)
+		audio.fd = STDIN_FILENO;
+	else if ((audio.fd = open(audio.path, O_RDONLY)) < 0)
+	{
+		log_error("%s: %s", audio.path, strerror(errno));
+		return -1;
+	}
+	audio.paced = fstat(audio.fd, &st) == 0 && S_ISREG(st.st_mode);
+	if (source_probe())
+		return -1;
+	if (audio.paced)
+		audio.data_start = lseek(audio.fd, 0, SEEK_CUR) - audio.pre_len;
+	return 0;
+}
+
+// End of input: loop a file, wait for the next writer of a FIFO, stop on stdin
+static int source_restart(void)
+{
+	if (audio.paced)
+	{
+		audio.pre_len = 0;
+		return lseek(audio.fd, audio.data_start, SEEK_SET) < 0 ? -1 : 0;
+	}
+	if (audio.fd == STDIN_FILENO)
+		return -1;
+	close(audio.fd);
+	return source_open();
+}
+
+static void *audio_thread(void *arg)
+{
+	static int16_t pcm[AUDIO_HOP * AUDIO_MAX_CHANNELS];
+	static struct audio_state state;
+	struct audio_frame frame;
+	struct timespec next;
+	size_t want = 0;
+	long hop_ns = 0;
+	int rate = 0, channels = 0;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (audio.running)
+	{
+		// the next writer of a FIFO may send another format
+		if (audio.rate != rate || audio.channels != channels)
+		{
+			rate = audio.rate;
+			channels = audio.channels;
+			audio_state_init(&state, rate);
+			want = AUDIO_HOP * channels * sizeof pcm[0];
+			hop_ns = 1000000000L / rate * AUDIO_HOP;
+		}
+
+		if (source_read(pcm, want) != (ssize_t)want)
+		{
+			if (source_restart())
+				break;
+			continue;
+		}
+
+		// a file has no writer pacing it, so replay it in real time
+		if (audio.paced)
+		{
+			next.tv_nsec += hop_ns;
+			if (next.tv_nsec >= 1000000000L)
+			{
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+
+		if (!audio.active)
+			continue;
+		audio_analyse(&state, pcm, audio.channels, &frame);
+		audio.show(&frame);
+	}
+
+	log_warn("audio: end of input");
+	audio.running = 0;
+	return NULL;
+}
+
+int audio_start(const char *source, int rate, int channels,
+		void (*show)(const struct audio_frame *frame))
+{
+	if (channels < 1 || channels > AUDIO_MAX_CHANNELS || rate < 8000)
+	{
+		log_error("audio: unsupported format (%d channels, %d Hz)", channels, rate);
+		return -1;
+	}
+	audio.path = source;
+	audio.rate = rate;
+	audio.channels = channels;
+	audio.show = show;
+	if (source_open())
+		return -1;
+
+	audio.running = 1;
+	if (pthread_create(&audio.thread, NULL, audio_thread, NULL))
+	{
+		audio.running = 0;
+		return -1;
+	}
+	pthread_detach(audio.thread);
+	return 0;
+}
+
+int audio_set_active(int active)
+{
+	audio.active = active;
+	return active && audio.running;
+}
+
+
+// PART 3 - benchmark --------------------------------------------------
+
+int audio_bench(void)
+{
+	enum { SECONDS = 4, RATE = AUDIO_DEFAULT_RATE, CH = AUDIO_DEFAULT_CHANNELS };
+	static int16_t pcm[SECONDS * RATE * CH];
+	static struct audio_state state;
+	struct audio_frame frame;
+	double start, wall, cpu, rate;
+	static volatile unsigned sink;		// keeps the analysis from being optimised away
+	long windows = 0;
+	int i, pos;
+
+	// swept sine with a 120 bpm kick and a little noise
+	for (i = 0; i < SECONDS * RATE; i++)
+	{
+		float t = (float)i / RATE;
+		float v = 0.4f * sinf(2.0f * (float)M_PI * (100.0f + 4000.0f * t / SECONDS) * t);
+		if (fmodf(t, 0.5f) < 0.05f)
+			v += 0.5f * sinf(2.0f * (float)M_PI * 60.0f * t);
+		v += 0.05f * ((float)rand() / RAND_MAX - 0.5f);
+		pcm[i * CH] = pcm[i * CH + 1] = (int16_t)(v * 32767.0f);
+	}
+
+	audio_state_init(&state, RATE);
+	start = delay_sec(CLOCK_MONOTONIC);
+	cpu = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	pos = 0;
+	do
+	{
+		for (i = 0; i < 1000; i++)
+		{
+			audio_analyse(&state, pcm + pos * CH, CH, &frame);
+			sink += frame.bars[0] ^ frame.beats;
+			pos += AUDIO_HOP;
+			if (pos + AUDIO_HOP > SECONDS * RATE)
+				pos = 0;
+		}
+		windows += 1000;
+		wall = delay_sec(CLOCK_MONOTONIC) - start;
+	} while (wall < 2.0);
+	cpu = delay_sec(CLOCK_THREAD_CPUTIME_ID) - cpu;
+
+	rate = windows / cpu;
+	printf("audio: %d point FFT, hop %d, %d bars, %d beat bands\n",
+	       FFT_N, AUDIO_HOP, AUDIO_BARS, AUDIO_BEATS);
+	printf("audio: %ld windows in %.2fs cpu: %.0f windows/s, %.2f us/window\n",
+	       windows, cpu, rate, 1e6 / rate);
+	printf("audio: real time at %d Hz needs %.0f windows/s = %.2f%% of this core\n",
+	       RATE, (double)RATE / AUDIO_HOP, 100.0 * RATE / AUDIO_HOP / rate);
+	printf("audio: worst case sample to LED latency %.2f ms (hop) + %.3f ms (FFT)\n",
+	       1000.0 * AUDIO_HOP / RATE, 1000.0 / rate);
+	return 0;
+}
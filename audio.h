@@ -0,0 +1,42 @@
+/*
+ * audio.h: streaming audio spectrum analyser for the 010 mode
+ *
+ * Reads signed 16 bit little endian PCM (raw or WAV) from stdin, a FIFO or
+ * a file and turns each sliding window into five 12 bit bar graphs plus
+ * eight beat flags.
+ */
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+#define AUDIO_FFT_SIZE		256	// samples per analysis window (power of 2)
+#define AUDIO_HOP		64	// new samples between two windows
+#define AUDIO_BARS		5	// PC, MA, MB, AC, MQ
+#define AUDIO_BEATS		8	// AND .. OPR operation LEDs
+#define AUDIO_MAX_CHANNELS	8
+
+#define AUDIO_DEFAULT_RATE	44100
+#define AUDIO_DEFAULT_CHANNELS	2
+
+struct audio_frame {
+	uint16_t bars[AUDIO_BARS];	// 12 bit bar graphs, growing from the left
+	uint8_t  beats;			// bit 0 = first beat band (bass)
+};
+
+// Start the reader thread.  source is a path or "-" for stdin.  rate and
+// channels describe raw PCM and are replaced by the header of a WAV file.
+// show() is called from the reader thread for every analysed window while
+// the mode is active.  Returns 0 on success.
+int audio_start(const char *source, int rate, int channels,
+		void (*show)(const struct audio_frame *frame));
+
+// Enable or disable analysis (input keeps being drained while disabled).
+// Returns nonzero if active and an audio source is running.
+int audio_set_active(int active);
+
+// Benchmark the analysis path on a synthetic signal, report windows/second
+int audio_bench(void);
+
+#endif
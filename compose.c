@@ -0,0 +1,116 @@
+/*
+ * compose.c: layered frames for the LED rows
+ *
+ * Blending is two word operations per layer and row: clear what the
+ * layer covers, or in its bits.  Five layers over eight rows is a few
+ * dozen instructions, far less than redrawing a mode with rand().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compose.h"
+#include "delay.h"
+
+void compose_enable(struct compositor *c, unsigned enabled)
+{
+	if (enabled != c->enabled)
+		c->changed |= enabled ^ c->enabled;
+	c->enabled = enabled;
+}
+
+int compose_redraw(struct compositor *c, int id)
+{
+	if (!(c->dirty & LAYER_BIT(id)))
+		return 0;
+	c->dirty &= ~LAYER_BIT(id);
+	c->changed |= LAYER_BIT(id);
+	memset(&c->layer[id], 0, sizeof c->layer[id]);
+	return 1;
+}
+
+int compose(struct compositor *c, volatile uint32_t *rows)
+{
+	uint32_t out[8] = { 0 }, cover[8] = { 0 };
+	uint32_t old, new;
+	const struct layer *l;
+	int id, r, written = 0;
+
+	if (!c->changed)
+		return 0;
+	c->changed = 0;
+
+	for (id = 0; id < LAYERS; id++)
+	{
+		if (!(c->enabled & LAYER_BIT(id)))
+			continue;
+		l = &c->layer[id];
+		for (r = 0; r < 8; r++)
+		{
+			out[r] = (out[r] & ~l->mask[r]) | (l->bits[r] & l->mask[r]);
+			cover[r] |= l->mask[r];
+		}
+	}
+
+	for (r = 0; r < 8; r++)
+	{
+		if (!(cover[r] | c->cover[r]))
+			continue;
+		do
+		{
+			old = rows[r];
+			new = (old & ~(cover[r] | c->cover[r])) | out[r];
+		} while (old != new && !__sync_bool_compare_and_swap(&rows[r], old, new));
+		c->cover[r] = cover[r];
+		written++;
+	}
+	return written;
+}
+
+
+// PART 1 - benchmark --------------------------------------------------
+
+int compose_bench(void)
+{
+	static struct compositor c;
+	static volatile uint32_t rows[8];
+	double start, t_compose, t_draw;
+	long n, frames = 0, draws = 0;
+	int id, r;
+
+	c.enabled = LAYER_BIT(LAYERS) - 1;
+	for (id = 0; id < LAYERS; id++)
+		for (r = 0; r < 8; r++)
+		{
+			c.layer[id].bits[r] = rand() & 07777;
+			c.layer[id].mask[r] = rand() & 07777;
+		}
+
+	// recompose every layer, as if all were dirty
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 10000; n++)
+		{
+			c.changed = LAYER_BIT(LAYER_OPLEDS);
+			compose(&c, rows);
+		}
+		frames += n;
+	} while ((t_compose = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+
+	// what a base layer redraw of the normal mode costs: 8 rand() calls
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 10000; n++)
+			for (r = 0; r < 8; r++)
+				c.layer[LAYER_BASE].bits[r] = rand() & 07777;
+		draws += n;
+	} while ((t_draw = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+
+	printf("compose: %d layers x 8 rows in %.1f ns per frame\n", LAYERS, 1e9 * t_compose / frames);
+	printf("compose: redrawing a random base layer takes %.1f ns\n", 1e9 * t_draw / draws);
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * compose.h: layered frames for the LED rows
+ *
+ * A frame is built from layers, bottom to top: the mode's base pattern,
+ * an animation (snake), the clock, the operation LEDs and the status
+ * LEDs.  Each layer is 8 rows of bits plus 8 rows of mask; a layer only
+ * shows where its mask is set.  Layers are redrawn only when marked
+ * dirty, and the frame is only recomposed when some layer changed.
+ */
+
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+#include <stdint.h>
+
+enum layer_id {
+	LAYER_BASE,		// the mode's pattern
+	LAYER_ANIMATION,	// snake
+	LAYER_CLOCK,		// binary clock
+	LAYER_OPLEDS,		// operation and link LEDs
+	LAYER_STATUS,		// run, pause and execute LEDs
+	LAYERS
+};
+
+#define LAYER_BIT(id)	(1u << (id))
+
+struct layer {
+	uint32_t bits[8];
+	uint32_t mask[8];
+};
+
+struct compositor {
+	struct layer layer[LAYERS];
+	unsigned enabled;		// LAYER_BIT()s shown
+	unsigned dirty;			// LAYER_BIT()s to redraw
+	unsigned changed;		// LAYER_BIT()s redrawn since the last compose
+	uint32_t cover[8];		// bits the last compose wrote
+};
+
+// Draw an item ({row, shift, mask} as in deeper.c) into a layer
+#define LAYER_STORE(l, item, value) { \
+	(l)->bits[item[0]] = ((l)->bits[item[0]] & ~(item[2] << item[1])) | (((value) & item[2]) << item[1]); \
+	(l)->mask[item[0]] |= item[2] << item[1]; }
+
+// Show the layers in the LAYER_BIT()s enabled
+void compose_enable(struct compositor *c, unsigned enabled);
+
+// Does a layer need redrawing?  Clears its dirty flag and makes it
+// transparent, ready to be drawn again.
+int compose_redraw(struct compositor *c, int id);
+
+// Blend the enabled layers into rows if any changed.  Bits no enabled
+// layer covers are left alone (the audio thread owns them in audio mode),
+// or cleared if a layer covered them last time; rows are merged with a
+// compare and swap.  Returns the number of rows written.
+int compose(struct compositor *c, volatile uint32_t *rows);
+
+// Measure a full recompose against the redraw it saves
+int compose_bench(void);
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * config.c: mode and timing configuration, reloaded while running
+ *
+ * File format, one setting per line, '#' starts a comment:
+ *
+ *	opled_delay = 20000		us, also clock_delay, pause_delay
+ *	delay_unit = 50000		us per step of the delay switches
+ *	mode.2 = sysload		mode for DF switches 010 (octal)
+ *	mode.21 = clock			... only with IF switches 001, wherever
+ *					the mode.2 line is
+ *	normal.opled = 50 10 20 20 20 60 40 40	AND .. OPR chance in percent
+ *	normal.link = 20
+ *	normal.clock = 1		time over the mode, also .snake
+ *	life.rule = B3/S23		life.wrap = 1
+ *
+ * The directory of the file is watched with inotify, so editors that
+ * write a new file and rename it over the old one are picked up too.
+ * A file with errors is reported and ignored; the running table stays.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "life.h"
+#include "log.h"
+
+const char *const mode_names[MODE_KINDS] = {
+	"test", "snake", "audio", "sleep", "sysload", "dim", "clock", "normal", "life", "dark"
+};
+
+// The values that used to be compiled in
+static const struct config defaults = {
+	.opled_delay = 20000,
+	.delay_unit  = 50000,
+	.clock_delay = 500000,
+	.pause_delay = 250000,
+	.life_birth   = 1 << 3,			// B3/S23
+	.life_survive = 1 << 2 | 1 << 3,
+	.life_wrap    = 1,
+	.kind = {
+		[MODE_TEST]    = { { 100, 100, 100, 100, 100, 100, 100, 100 }, 100 },
+		[MODE_SNAKE]   = { {  50,  10,  20,  20,  20,  60,  40,  40 },   0, .snake = 1 },
+		[MODE_AUDIO]   = { {   0,   0,   0,   0,   0,   0,   0,   0 },   0 },
+		[MODE_SLEEP]   = { {  20,   2,   5,   5,   5,  15,  10,  10 },   0 },
+		[MODE_SYSLOAD] = { { 100, 100, 100, 100, 100, 100, 100, 100 },   0 },
+		[MODE_DIM]     = { {  50,   5,  10,  10,  10,  30,  20,  20 },   0 },
+		[MODE_CLOCK]   = { {  50,   5,  10,  10,  10,  30,  20,  20 },   0, .clock = 1 },
+		[MODE_NORMAL]  = { {  50,  10,  20,  20,  20,  60,  40,  40 },  20 },
+		[MODE_LIFE]    = { {  50,  10,  20,  20,  20,  60,  40,  40 },   0 },
+		[MODE_DARK]    = { {   0,   0,   0,   0,   0,   0,   0,   0 },   0 },
+	},
+};
+
+static struct {
+	const char     *path;
+	struct config  *current;
+	pthread_mutex_t lock;
+	pthread_t       watcher;
+} cfg = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+// PART 1 - parser -----------------------------------------------------
+
+static char *trim(char *s)
+{
+	char *end;
+
+	while (*s == ' ' || *s == '\t')
+		s++;
+	end = s + strlen(s);
+	while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+		*--end = 0;
+	return s;
+}
+
+static int parse_number(const char *s, unsigned long max, unsigned long *out)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtoul(s, &end, 10);
+	return errno || end == s || *trim(end) || *out > max ? -1 : 0;
+}
+
+static int parse_kind(const char *s)
+{
+	int i;
+
+	for (i = 0; i < MODE_KINDS; i++)
+		if (strcmp(s, mode_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+// mode.D or mode.DI with octal switch values.  The more specific mode.DI
+// wins whatever the order, and so do the built-in ones, so a mode.3 line
+// from before the dark mode doesn't hide mode.37.
+static int parse_mode(struct config *c, const char *sw, const char *value)
+{
+	int kind = parse_kind(value);
+	int df, i;
+
+	if (kind < 0 || sw[0] < '0' || sw[0] > '7')
+		return -1;
+	df = sw[0] - '0';
+	if (sw[1] == 0)
+	{
+		for (i = df * 8; i < df * 8 + 8; i++)
+			if (!(c->mode_if & 1ULL << i))
+				c->mode[i] = kind;
+		return 0;
+	}
+	if (sw[1] < '0' || sw[1] > '7' || sw[2] != 0)
+		return -1;
+	i = df * 8 + sw[1] - '0';
+	c->mode[i] = kind;
+	c->mode_if |= 1ULL << i;
+	return 0;
+}
+
+static int parse_opleds(struct mode_config *m, char *value)
+{
+	unsigned long v;
+	char *tok, *save;
+	int i = 0;
+
+	for (tok = strtok_r(value, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save))
+	{
+		if (i == CONFIG_OPLEDS || parse_number(tok, 100, &v))
+			return -1;
+		m->opled[i++] = v;
+	}
+	return i == CONFIG_OPLEDS ? 0 : -1;
+}
+
+static int parse_setting(struct config *c, const char *key, char *value)
+{
+	unsigned long v;
+	const char *dot;
+	int kind;
+
+	if (strcmp(key, "opled_delay") == 0)
+		return parse_number(value, 10000000, &v) ? -1 : (c->opled_delay = v, 0);
+	if (strcmp(key, "delay_unit") == 0)
+		return parse_number(value, 10000000, &v) || v == 0 ? -1 : (c->delay_unit = v, 0);
+	if (strcmp(key, "clock_delay") == 0)
+		return parse_number(value, 10000000, &v) ? -1 : (c->clock_delay = v, 0);
+	if (strcmp(key, "pause_delay") == 0)
+		return parse_number(value, 10000000, &v) ? -1 : (c->pause_delay = v, 0);
+	if (strncmp(key, "mode.", 5) == 0)
+		return parse_mode(c, key + 5, value);
+
+	// <kind>.opled, .link, .clock and .snake, life.rule and life.wrap
+	if ((dot = strchr(key, '.')) == NULL)
+		return -1;
+	for (kind = 0; kind < MODE_KINDS; kind++)
+		if (strlen(mode_names[kind]) == (size_t)(dot - key) &&
+		    strncmp(key, mode_names[kind], dot - key) == 0)
+			break;
+	if (kind == MODE_KINDS)
+		return -1;
+	if (strcmp(dot, ".opled") == 0)
+		return parse_opleds(&c->kind[kind], value);
+	if (strcmp(dot, ".link") == 0)
+		return parse_number(value, 100, &v) ? -1 : (c->kind[kind].link = v, 0);
+	if (strcmp(dot, ".clock") == 0)
+		return parse_number(value, 1, &v) ? -1 : (c->kind[kind].clock = v, 0);
+	if (strcmp(dot, ".snake") == 0)
+		return parse_number(value, 1, &v) ? -1 : (c->kind[kind].snake = v, 0);
+	if (kind == MODE_LIFE && strcmp(dot, ".rule") == 0)
+		return life_parse_rule(value, &c->life_birth, &c->life_survive);
+	if (kind == MODE_LIFE && strcmp(dot, ".wrap") == 0)
+		return parse_number(value, 1, &v) ? -1 : (c->life_wrap = v, 0);
+	return -1;
+}
+
+static void config_defaults(struct config *c)
+{
+	int i;
+
+	*c = defaults;
+	for (i = 0; i < 64; i++)
+		c->mode[i] = i / 8;	// the DF switches pick the kind of the same number
+	for (i = 1; i < 8; i++)
+		c->mode[MODE_AUDIO * 8 + i] = MODE_LIFE;
+	c->mode[MODE_SLEEP * 8 + 7] = MODE_DARK;
+	c->mode_if = 0376ULL << MODE_AUDIO * 8 | 1ULL << (MODE_SLEEP * 8 + 7);
+}
+
+// Parse the file on top of the defaults.  -1 on errors, 1 if it doesn't exist.
+static int config_parse(const char *path, struct config *c)
+{
+	char line[256];
+	char *key, *value, *eq;
+	int lineno = 0, errors = 0;
+	FILE *fp;
+
+	config_defaults(c);
+	if ((fp = fopen(path, "r")) == NULL)
+		return errno == ENOENT ? 1 : -1;
+	while (fgets(line, sizeof line, fp))
+	{
+		lineno++;
+		if ((value = strchr(line, '#')) != NULL)
+			*value = 0;
+		key = trim(line);
+		if (*key == 0)
+			continue;
+		if ((eq = strchr(key, '=')) == NULL)
+		{
+			log_warn("%s:%d: expected key = value", path, lineno);
+			errors++;
+			continue;
+		}
+		*eq = 0;
+		key = trim(key);
+		value = trim(eq + 1);
+		if (parse_setting(c, key, value))
+		{
+			log_warn("%s:%d: bad setting '%s'", path, lineno, key);
+			errors++;
+		}
+	}
+	fclose(fp);
+	return errors ? -1 : 0;
+}
+
+
+// PART 2 - table swap and watcher ---------------------------------------
+
+const struct config *config_get(void)
+{
+	struct config *c;
+
+	pthread_mutex_lock(&cfg.lock);
+	c = cfg.current;
+	c->refs++;
+	pthread_mutex_unlock(&cfg.lock);
+	return c;
+}
+
+void config_put(const struct config *cfg_in)
+{
+	struct config *c = (struct config *)cfg_in;
+	int refs;
+
+	pthread_mutex_lock(&cfg.lock);
+	refs = --c->refs;
+	pthread_mutex_unlock(&cfg.lock);
+	if (refs == 0)
+		free(c);
+}
+
+// Make c current; the old table goes once its last frame is done with it
+static void config_swap(struct config *c)
+{
+	static uint32_t generation;
+	struct config *old;
+
+	c->refs = 1;			// the reference held by cfg.current
+	pthread_mutex_lock(&cfg.lock);
+	c->generation = ++generation;
+	old = cfg.current;
+	cfg.current = c;
+	pthread_mutex_unlock(&cfg.lock);
+	if (old)
+		config_put(old);
+}
+
+static int config_load(void)
+{
+	struct config *c = malloc(sizeof *c);
+	int ret;
+
+	if (c == NULL)
+		return -1;
+	ret = config_parse(cfg.path, c);
+	if (ret < 0 && cfg.current)
+	{
+		log_warn("%s: not reloaded, keeping the running configuration", cfg.path);
+		free(c);
+		return -1;
+	}
+	if (ret < 0)
+	{
+		log_warn("%s: using the built-in configuration", cfg.path);
+		config_defaults(c);
+	}
+	config_swap(c);
+	return ret < 0 ? -1 : 0;
+}
+
+static void *config_watcher(void *arg)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *name;
+	char dir[PATH_MAX];
+	int fd = -1, changed;
+	ssize_t len, i;
+
+	(void)arg;
+	name = strrchr(cfg.path, '/');
+	if (name)
+		snprintf(dir, sizeof dir, "%.*s", (int)(name - cfg.path) + 1, cfg.path);
+	else
+		strcpy(dir, ".");
+	name = name ? name + 1 : cfg.path;
+
+	if ((fd = inotify_init()) < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		log_warn("%s: can't watch for changes: %s", cfg.path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		len = read(fd, buf, sizeof buf);
+		if (len <= 0)
+		{
+			if (len < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		changed = 0;
+		for (i = 0; i < len; i += sizeof *ev + ev->len)
+		{
+			ev = (const struct inotify_event *)(buf + i);
+			if (ev->len && strcmp(ev->name, name) == 0)
+				changed = 1;
+		}
+		if (changed && config_load() == 0)
+			log_info("Reloaded %s", cfg.path);
+	}
+	close(fd);
+	return NULL;
+}
+
+int config_start(const char *path)
+{
+	int ret;
+
+	cfg.path = path;
+	ret = config_load();
+	if (pthread_create(&cfg.watcher, NULL, config_watcher, NULL) == 0)
+		pthread_detach(cfg.watcher);
+	return ret;
+}
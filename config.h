@@ -0,0 +1,66 @@
+/*
+ * config.h: mode and timing configuration, reloaded while running
+ *
+ * The configuration file is parsed into a compact table.  An inotify
+ * watcher thread parses every new version of the file into a fresh table
+ * and swaps it in; a frame takes a reference to the current table when it
+ * starts and drops it when it ends, so a frame never sees two versions.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+#define CONFIG_DEFAULT_PATH	"/etc/deeper.conf"
+
+// Mode kinds, numbered like the DF switches that select them by default
+enum mode_kind {
+	MODE_TEST,		// 000
+	MODE_SNAKE,		// 001
+	MODE_AUDIO,		// 010
+	MODE_SLEEP,		// 011
+	MODE_SYSLOAD,		// 100
+	MODE_DIM,		// 101
+	MODE_CLOCK,		// 110
+	MODE_NORMAL,		// 111
+	MODE_LIFE,		// 010 with IF switches other than 000
+	MODE_DARK,		// 011 with IF switches 111
+	MODE_KINDS
+};
+
+#define CONFIG_OPLEDS	8	// AND TAD ISZ DCA JMS JMP IOT OPR
+
+struct mode_config {
+	uint8_t opled[CONFIG_OPLEDS];	// chance in percent per operation LED
+	uint8_t link;			// chance in percent of the link LED
+	uint8_t clock;			// show the time over the mode
+	uint8_t snake;			// run the snake over the mode
+};
+
+struct config {
+	int      refs;			// frames still using this table
+	uint32_t generation;		// counts up with every table swapped in
+	uint32_t opled_delay;		// us the operation LEDs are dark each cycle
+	uint32_t delay_unit;		// us per step of the delay switches
+	uint32_t clock_delay;		// us between binary clock updates
+	uint32_t pause_delay;		// us between checks while paused
+	uint16_t life_birth;		// life rule, bit n = n neighbours
+	uint16_t life_survive;
+	uint8_t  life_wrap;		// life grid edges wrap around
+	uint8_t  mode[64];		// mode kind by DF switches * 8 + IF switches
+	uint64_t mode_if;		// entries set for one IF setting, mode.D leaves them
+	struct mode_config kind[MODE_KINDS];
+};
+
+extern const char *const mode_names[MODE_KINDS];
+
+// Load path (missing file = built-in defaults) and start watching it.
+// Returns 0 unless the file exists and can't be parsed.
+int config_start(const char *path);
+
+// Take the current table at the start of a frame, release it at the end
+const struct config *config_get(void);
+void config_put(const struct config *cfg);
+
+#endif
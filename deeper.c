@@ -29,12 +29,14 @@
  * 	Added modes by changing the 3 far left brown switches (0=down / 1=up)
  * 		111 = Normal mode with all LEDs flashing (Default / Undefined fallback)
  * 		011 = Sleep Mode (All LEDs off except for the columns on the right side of the panel)
+ *		      Dark when all IF switches are up (Every LED off, the multiplexer parks)
  * 		101 = Dim Mode - Fewer LEDs Blink (Only the Program Counter, Memory Address and Memory Buffer groups)
  * 		110 = Binary Clock (From top to bottom: Hour, Minute, Second, Month, Day)
  * 		001 = Snake Mode (3 LEDs move across a row then down to the next row in the opposite direction)
  * 		000 = Test Mode (All LEDs on steady, except some of the columns of LEDs on the right blink off for 20ms)
- *		010 = {Spare}
- *		100 = {Spare}
+ *		010 = Audio Spectrum (Needs an audio source, see -a below.  Five frequency bands as bar graphs, beats on the operation LEDs)
+ *		      Life when any IF switch is up (Cellular automaton on the five data registers)
+ *		100 = System Load (CPU, memory, disk, network and load average as bar graphs)
  * 
  * 	Expanded the timing switches from 6 to 12 switches
  * 		The third brown and third white switch groups control the maximum delay (slowest speed)
@@ -64,9 +66,71 @@
  * 		Shutdown system - Flip both the Sing Inst and Sing Step switches down and hold the Stop button for 3 seconds
  * 		Reboot system - Flip both the Sing Inst and Sing Step switches down and hold the Start button for 3 seconds
  *
+ * 	Audio spectrum mode (010)
+ * 		Reads signed 16 bit PCM from stdin, a FIFO or a WAV file given with -a (use - for stdin)
+ * 		Raw PCM is taken as 44100Hz stereo unless -r <rate> and -c <channels> say otherwise
+ * 		Example: arecord -f cd -t raw | sudo /usr/bin/deeper -a -
+ * 		Without an audio source the mode falls back to the normal mode
+ * 		"deeper -b audio" benchmarks the analysis and reports windows per second
+ *
+ * 	System load mode (100)
+ * 		Program Counter: a bar per CPU (with more than 12 CPUs a bit per group of CPUs, on if any is busy)
+ * 		Memory Address: memory in use / Memory Buffer: disk throughput / Accumulator: network throughput
+ * 		Multiplier Quotient: 1 minute load average, full at two per CPU
+ * 		Disk and network bars are logarithmic, one LED per doubling from 16KB/s
+ * 		The IF switches set the refresh rate from 10Hz (000) to 50Hz (111)
+ * 		"deeper -b sysload" benchmarks the /proc read and parse path
+ *
+ * 	Life mode (010 with IF switches up)
+ * 		A cellular automaton on the 12 x 5 grid of the data registers, one generation per cycle
+ * 		IF switches 001 use life.rule from the configuration (B3/S23 = Conway's Life by default),
+ * 		010 to 111 pick HighLife, Seeds, Day & Night, Replicator, Morley and Maze
+ * 		The start pattern comes from the switch register (all down = random)
+ * 		A grid that dies out or repeats itself within 32 generations is reseeded
+ * 		"deeper -b life" reports generations per microsecond
+ *
+ * 	Mirroring
+ * 		-m host[:port] sends every change of the LEDs and switches to host as UDP datagrams (port 8008)
+ * 		Run "deeper-rx [-p port]" on host to print (and record) the frames of one or more panels
+ * 		-i id sets the panel number in the datagrams; panels are told apart by sender address and number
+ * 		"deeper -b mirror" measures bandwidth and CPU per frame over loopback
+ *
+ * 	Multiple panels
+ * 		One multiplexer thread refreshes every panel, lighting the same row of all panels at once
+ * 		Each panel keeps its own mode state and is stepped by a small worker pool
+ * 		"deeper -b panels" runs 1 to 16 simulated panels and reports CPU use and refresh stability
+ *
+ * 	Settle times
+ * 		The switch columns get the old 3us to settle and LED rows the old 10us anti-ghost wait, but
+ * 		spinning on the clock instead of sleeping, so they are no longer overshot by tens of microseconds
+ * 		"deeper -b delay" reports clock and sleep costs and the old waits next to the new ones
+ *
+ * 	Parking
+ * 		While every LED is off the multiplexer only reads the switches at 50Hz and sleeps in between
+ * 		A frame with any LED on wakes it at once
+ * 		The dark mode (DF 3, IF 7) composes only dark frames, so it never wakes the multiplexer
+ * 		"deeper -b park" reports CPU use in the dark mode and how soon a frame or a switch is seen again
+ *
+ * 	Layers
+ * 		A frame is composed from layers: the mode's pattern, the snake, the clock, the operation LEDs
+ * 		and the status LEDs; only layers that changed are redrawn
+ * 		<mode>.clock = 1 and <mode>.snake = 1 in the configuration show the clock or the snake over any mode
+ * 		"deeper -b compose" compares composing a frame with redrawing a layer
+ *
+ * 	Logging
+ * 		Messages are queued and written by a background thread, a stalled console never holds up the panel
+ * 		-l - (stdout, default), -l syslog or -l <file>; -v adds debug messages
+ * 		Messages that don't fit in the queue are dropped and counted
+ * 		"deeper -b log" measures the cost of a message with a fast and a stalled output
+ *
+ * 	Configuration
+ * 		Timing, the operation LED chances of each mode and the mode selected by the DF/IF switches
+ * 		are read from /etc/deeper.conf (or -f <file>), see deeper.conf for the settings
+ * 		Changes are applied as soon as the file is saved, without restarting
+ *
  * 	Misc Notes:
  *		Added console output that shows switch values when the switches change.
- * 		The blink delay is fixed to 1/2 second in Binary Clock mode.
+ * 		The blink delay is fixed to 1/2 second in Binary Clock mode (clock_delay in the configuration).
  * 		This should not be run simultaneously with the pidp8 simulator
  * 	
  *	Installation
@@ -88,6 +152,7 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -99,14 +164,21 @@ typedef signed int      int32;
 typedef unsigned short  uint16;
 typedef unsigned char   uint8;
 
-extern void *blink(void *ptr);	// the real-time multiplexing process to start up
-extern uint32 ledstatus[8];     // bitfields: 8 ledrows of up to 12 LEDs
-extern uint32 switchstatus[3];  // bitfields: 3 rows of up to 12 switches
 
 
 #include <signal.h>
 #include <ctype.h>
 
+#include "audio.h"
+#include "compose.h"
+#include "config.h"
+#include "delay.h"
+#include "life.h"
+#include "log.h"
+#include "mirror.h"
+#include "panel.h"
+#include "sysload.h"
+
 // GET / STORE             row   shift  mask value
 int programCounter[] 	= {0x00, 0,     07777};
 int dataField[] 	= {0x07, 9,     0777};
@@ -154,19 +226,26 @@ int step[]              = {0x01, 6,     077};
 // 2) shifts the value to the appropriate area of within the uint
 // 3) masks out the value that was previously there without effecting other bits
 // 4) or's the new value in place
-#define STORE(item, value) { ledstatus[item[0]] =  (ledstatus[item[0]] & ~(item[2] << item[1])  ) |  ((value & item[2]) << item[1]); }
+#define STORE(item, value) { p->ledstatus[item[0]] =  (p->ledstatus[item[0]] & ~(item[2] << item[1])  ) |  ((value & item[2]) << item[1]); }
 
 // GET
 // 1) gets shifts the value to the "normal" range
 // 2) masks off bits that are not related to our value
-#define GET(item)          ( (ledstatus    [ item[0] ] >> item[1]) & item[2] )
-#define GETSWITCH(flip)   !( (switchstatus [ flip[0] ] >> flip[1]) & flip[2] )
-#define GETSWITCHES(flip)  ( (switchstatus [ flip[0] ] >> flip[1]) & flip[2] )
+// All of them work on the panel p in scope.
+#define GET(item)          ( (p->ledstatus    [ item[0] ] >> item[1]) & item[2] )
+#define GETSWITCH(flip)   !( (p->switchstatus [ flip[0] ] >> flip[1]) & flip[2] )
+#define GETSWITCHES(flip)  ( (p->switchstatus [ flip[0] ] >> flip[1]) & flip[2] )
+
+// DRAW works like STORE, on the compose.h layer in scope
+#define DRAW(item, value)  LAYER_STORE(layer, item, value)
 
 
 int terminate=0;
+int sysloadOk;			// /proc is readable for the 100 mode
+struct panel *audioPanel;	// the panel showing the audio spectrum
 
-int opled_delay = 20000;
+// Operation LEDs in the order of the chances in struct mode_config
+int *opLEDs[CONFIG_OPLEDS] = { andLED, tadLED, iszLED, dcaLED, jmsLED, jmpLED, iotLED, oprLED };
 
 
 // Handle CTRL-C
@@ -195,359 +274,510 @@ int rand_flag( int max_rand, int max_true )
 	}
 }
 
+// Randomly blink the operation and link LEDs with the chances configured
+// for a mode kind, scaled by percent
+void store_random_opleds( struct layer *layer, const struct mode_config *kind, int percent )
+{
+	int i;
 
-int main( int argc, char *argv[] )
+	for (i = 0; i < CONFIG_OPLEDS; i++)
+		DRAW(opLEDs[i], rand_flag(100, kind->opled[i] * percent / 100));
+	DRAW(linkLED, rand_flag(100, kind->link * percent / 100));
+}
+
+
+// Called from the audio thread for every analysed window in 010 mode.
+// Rows 0-4 only hold the data registers, which the main loop leaves alone
+// in this mode.  The operation LEDs share row 5 with the main loop, so the
+// beat flags are merged in with a compare and swap; a flag lost to a racing
+// STORE in the main loop is redrawn with the next window.
+void show_audio_frame( const struct audio_frame *frame )
 {
-  pthread_t     thread1;
-  int           iret1;
-  unsigned long sleepTime;
-  int           deeperThoughMode = 0;
-  int           dontChangeLEDs = 0;
-  unsigned long delayAmount;
-  unsigned long varietyAmount;
-  unsigned long varietyMult;
-  unsigned long swRegValue;
-  unsigned long swStepValue;
-  unsigned long stopPressedTime;
-  unsigned long startPressedTime;
-  int swIfValue;
-  time_t currentTime;
-  struct tm *localTime;
-  int hour;
-  int min;
-  int sec;
-  int x, y, shift_dir;
-  
-  x = 1;
-  y = 1;
-  shift_dir = 1;
-  
-  swRegValue = 0;
-  swStepValue = 0;
+	struct panel *p = audioPanel;
+	uint32 old, new, beats;
+	int i;
+
+	STORE(programCounter,    frame->bars[0]);
+	STORE(memoryAddress,     frame->bars[1]);
+	STORE(memoryBuffer,      frame->bars[2]);
+	STORE(accumulator,       frame->bars[3]);
+	STORE(multiplierQuotient,frame->bars[4]);
+
+	// bass on the AND LED (bit 11) down to treble on the OPR LED (bit 4)
+	beats = 0;
+	for (i = 0; i < AUDIO_BEATS; i++)
+		if (frame->beats & (1 << i))
+			beats |= 1 << (andLED[1] - i);
+	do
+	{
+		old = p->ledstatus[andLED[0]];
+		new = (old & ~07760) | beats;
+	} while (!__sync_bool_compare_and_swap(&p->ledstatus[andLED[0]], old, new));
+	multiplex_wake(p);
+	mirror_publish(p->ledstatus);
+}
 
-  // install handler to terminate future thread
-  if( signal(SIGINT, sig_handler) == SIG_ERR )
-    {
-      fprintf( stderr, "Failed to install SIGINT handler.\n" );
-      exit( EXIT_FAILURE );
-    }
+void usage( const char *name )
+{
+  fprintf( stderr, "Usage: %s [-f config] [-a source] [-r rate] [-c channels] [-m host[:port]] [-i id] [-l log] [-v] [-b benchmark]\n"
+		   "  -f config    mode and timing configuration (default %s)\n"
+		   "  -a source    PCM audio for the 010 mode: file, FIFO or - for stdin\n"
+		   "  -r rate      sample rate of raw PCM (default %d)\n"
+		   "  -c channels  channels of raw PCM (default %d)\n"
+		   "  -m host      mirror the panel to deeper-rx on host (default port %d)\n"
+		   "  -i id        panel number sent with -m (default 0)\n"
+		   "  -l log       messages to - (stdout, default), syslog or a file\n"
+		   "  -v           debug messages too\n"
+		   "  -b name      run a benchmark and exit (audio, sysload, life, mirror, panels, delay,\n"
+		   "               compose, log, park)\n",
+		   name, CONFIG_DEFAULT_PATH, AUDIO_DEFAULT_RATE, AUDIO_DEFAULT_CHANNELS, MIRROR_DEFAULT_PORT );
+  exit( EXIT_FAILURE );
+}
 
-  // create thread
-  iret1 = pthread_create( &thread1, NULL, blink, &terminate );
 
-  if( iret1 )
-    {
-      fprintf( stderr, "Error creating thread, return code %d\n", iret1 );
-      exit( EXIT_FAILURE );
-    }
+// Draw the snake on the animation layer and move it one LED.  Only the
+// register the snake is in is covered, the others show the layers below.
+void draw_snake( struct panel *p, struct layer *layer )
+{
+	switch(p->y)
+	{
+		case 1:
+			DRAW(programCounter, 	 p->x & programCounter[2]);
+			break;
+		case 2:
+			DRAW(memoryAddress,     p->x & memoryAddress[2]);
+			break;
+		case 3:
+			DRAW(memoryBuffer,      p->x & memoryBuffer[2]);
+			break;
+		case 4:
+			DRAW(accumulator,       p->x & accumulator[2]);
+			break;
+		case 5:
+			DRAW(multiplierQuotient, p->x & multiplierQuotient[2]);
+			break;
+		default:
+			p->y = 1;
+	}
+	if(p->shift_dir == 1 && p->x < 14336)
+	{
+		p->x = p->x << 1;
+		if(p->x < 7)
+			p->x += 1;
+	}
+	else if(p->shift_dir == 0 && p->x > 1)
+	{
+		p->x = p->x >> 1;
+	}
+	else
+	{
+		p->shift_dir = !p->shift_dir;
+		p->y++;
+	}
+}
 
-  sleep( 2 );			// allow 2 sec for multiplex to start
+// Draw the time on the clock layer, and the date in the 110 mode
+void draw_clock( struct panel *p, struct layer *layer, time_t currentTime )
+{
+	struct tm tm;
 
-  srand(time(NULL));
+	localtime_r(&currentTime, &tm);
+	DRAW(programCounter,    tm.tm_hour);
+	DRAW(memoryAddress,     tm.tm_min);
+	DRAW(memoryBuffer,      tm.tm_sec);
+	if(p->modeKind == MODE_CLOCK)
+	{
+		DRAW(accumulator,       (tm.tm_mon + 1));
+		DRAW(multiplierQuotient,tm.tm_mday);
+	}
+}
+
+// Draw the mode's pattern on the base layer
+void draw_base( struct panel *p, struct layer *layer )
+{
+      // In future revisions, we'll have different randomization sequences
+      switch(p->modeKind)
+      {
+		  case MODE_SLEEP:	// 011 = Most LEDs Off
+		  case MODE_DARK:	// 011 with IF switches up = All LEDs Off
+			DRAW(programCounter,    0);
+			DRAW(memoryAddress,     0);
+			DRAW(memoryBuffer,      0);
+			DRAW(accumulator,       0);
+			DRAW(multiplierQuotient,0);
+			DRAW(stepCounter,       0);
+			DRAW(dataField,         0);
+			DRAW(instField,         0);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     0);
+			DRAW(fetchLED,   0);
+			break;
+		  case MODE_TEST:	// 000 = ALL LEDS ON
+			DRAW(programCounter,    65535 & programCounter[2]);
+			DRAW(memoryAddress,     65535 & memoryAddress[2]);
+			DRAW(memoryBuffer,      65535 & memoryBuffer[2]);
+			DRAW(accumulator,       65535 & accumulator[2]);
+			DRAW(multiplierQuotient,65535 & multiplierQuotient[2]);
+			DRAW(stepCounter,       65535 & stepCounter[2]);
+			DRAW(dataField,         65535 & dataField[2]);
+			DRAW(instField,         65535 & instField[2]);
+			DRAW(deferLED, 1);
+			DRAW(wordCountLED, 1);
+			DRAW(currentAddressLED, 1);
+			DRAW(breakLED, 1);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+		  case MODE_CLOCK:	// 110 = Binary Clock, drawn by draw_clock()
+		  case MODE_SNAKE:	// 001 = Snake, drawn by draw_snake()
+			DRAW(programCounter,    0);
+			DRAW(memoryAddress,     0);
+			DRAW(memoryBuffer,      0);
+			DRAW(accumulator,       0);
+			DRAW(multiplierQuotient,0);
+			DRAW(stepCounter,       0);
+			DRAW(dataField,         0);
+			DRAW(instField,         0);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+		  case MODE_DIM:	// 101 = Fewer Random LEDs
+			DRAW(programCounter,    rand() & programCounter[2]);
+			DRAW(memoryAddress,     rand() & memoryAddress[2]);
+			DRAW(memoryBuffer,      rand() & memoryBuffer[2]);
+			DRAW(accumulator,       0);
+			DRAW(multiplierQuotient,0);
+			DRAW(stepCounter,       0);
+			DRAW(dataField,         0);
+			DRAW(instField,         0);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+
+		  case MODE_SYSLOAD:	// 100 = System Load
+			if(sysloadOk)
+				sysload_sample(&p->load);
+			DRAW(programCounter,    p->load.bars[0]);
+			DRAW(memoryAddress,     p->load.bars[1]);
+			DRAW(memoryBuffer,      p->load.bars[2]);
+			DRAW(accumulator,       p->load.bars[3]);
+			DRAW(multiplierQuotient,p->load.bars[4]);
+			DRAW(stepCounter,       0);
+			DRAW(dataField,         0);
+			DRAW(instField,         0);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+
+		  case MODE_LIFE:	// 010 with IF switches up = Life
+			// IF switches 010 to 111 pick a preset rule, otherwise the configured one
+			if(p->swIfValue >= 2)
+				life_parse_rule(life_presets[p->swIfValue - 2], &p->life.birth, &p->life.survive);
+			else
+			{
+				p->life.birth = p->cfg->life_birth;
+				p->life.survive = p->cfg->life_survive;
+			}
+			p->life.wrap = p->cfg->life_wrap;
+			if(p->lastKind != MODE_LIFE)
+				life_seed(&p->life, GETSWITCHES(swregister));
+			else
+				life_step(&p->life, GETSWITCHES(swregister));
+			DRAW(programCounter,    life_row(&p->life, 0));
+			DRAW(memoryAddress,     life_row(&p->life, 1));
+			DRAW(memoryBuffer,      life_row(&p->life, 2));
+			DRAW(accumulator,       life_row(&p->life, 3));
+			DRAW(multiplierQuotient,life_row(&p->life, 4));
+			DRAW(stepCounter,       0);
+			DRAW(dataField,         0);
+			DRAW(instField,         0);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+
+		  case MODE_AUDIO:	// 010 = Audio Spectrum
+			if(p->audioActive)
+			{
+				// data registers and operation LEDs come from show_audio_frame()
+				DRAW(stepCounter,       0);
+				DRAW(dataField,         0);
+				DRAW(instField,         0);
+				DRAW(linkLED, 0);
+				DRAW(deferLED, 0);
+				DRAW(wordCountLED, 0);
+				DRAW(currentAddressLED, 0);
+				DRAW(breakLED, 0);
+				DRAW(ionLED,     1);
+				DRAW(fetchLED,   1);
+				break;
+			}
+			// no audio source, fall through to the normal mode
+
+		  default:
+			DRAW(programCounter,    rand() & programCounter[2]);
+			DRAW(memoryAddress,     rand() & memoryAddress[2]);
+			DRAW(memoryBuffer,      rand() & memoryBuffer[2]);
+			DRAW(accumulator,       rand() & accumulator[2]);
+			DRAW(multiplierQuotient,rand() & multiplierQuotient[2]);
+			DRAW(stepCounter,       rand() & stepCounter[2]);
+			DRAW(dataField,         rand() & dataField[2]);
+			DRAW(instField,         rand() & instField[2]);
+			DRAW(deferLED, 0);
+			DRAW(wordCountLED, 0);
+			DRAW(currentAddressLED, 0);
+			DRAW(breakLED, 0);
+			DRAW(ionLED,     1);
+			DRAW(fetchLED,   1);
+			break;
+      }
+}
 
-  // set the status LEDs
-  STORE(ionLED,     1);
-  STORE(fetchLED,   1);
-  STORE(executeLED, 1);
-  STORE(runLED,     1);
-  STORE(pauseLED,   0);
-  STORE(jmpLED,     1);
+// Does the base pattern of a mode change every cycle?
+int base_animated( struct panel *p )
+{
+	switch(p->modeKind)
+	{
+		case MODE_SLEEP:
+		case MODE_DARK:
+		case MODE_TEST:
+		case MODE_CLOCK:
+		case MODE_SNAKE:
+			return 0;
+		case MODE_AUDIO:
+			return ! p->audioActive;
+		default:
+			return 1;
+	}
+}
 
-  while(! terminate)
+// Choose the layers for this cycle and mark the ones that need redrawing
+void mark_layers( struct panel *p )
+{
+	struct compositor *c = &p->comp;
+	const struct mode_config *kind = &p->cfg->kind[p->modeKind];
+	unsigned enabled = LAYER_BIT(LAYER_BASE) | LAYER_BIT(LAYER_OPLEDS) | LAYER_BIT(LAYER_STATUS);
+	time_t now;
+
+	// the dark mode has no run LED either, so the multiplexer can park
+	// (its operation LEDs are configured off)
+	if(p->modeKind == MODE_DARK)
+		enabled &= ~LAYER_BIT(LAYER_STATUS);
+
+	// a new mode or configuration redraws everything
+	if(p->modeKind != p->lastKind || p->cfg->generation != p->cfgGeneration)
+	{
+		c->dirty = LAYER_BIT(LAYERS) - 1;
+		p->cfgGeneration = p->cfg->generation;
+	}
+
+	// audio writes the data registers straight into ledstatus, outside
+	// the compositor, so an overlay on them would flicker; none while
+	// audio is playing
+	if(kind->snake && ! p->audioActive)
+	{
+		enabled |= LAYER_BIT(LAYER_ANIMATION);
+		c->dirty |= LAYER_BIT(LAYER_ANIMATION);
+	}
+	if(kind->clock && ! p->audioActive)
+	{
+		enabled |= LAYER_BIT(LAYER_CLOCK);
+		now = time(NULL);
+		if(now != p->clockShown)
+			c->dirty |= LAYER_BIT(LAYER_CLOCK);
+	}
+	// in audio mode the operation LEDs show the beat flags
+	if(p->audioActive)
+		enabled &= ~LAYER_BIT(LAYER_OPLEDS);
+	compose_enable(c, enabled);
+
+	if(base_animated(p))
+		c->dirty |= LAYER_BIT(LAYER_BASE);
+	c->dirty |= LAYER_BIT(LAYER_OPLEDS);
+}
+
+// Draw the run, pause and execute LEDs if they changed.  The test mode
+// lights the pause LED too while its frame is up.
+void draw_status( struct panel *p, int execute )
+{
+	struct compositor *c = &p->comp;
+	struct layer *layer = &c->layer[LAYER_STATUS];
+	int pause = p->dontChangeLEDs || (execute && p->modeKind == MODE_TEST);
+	int status = execute << 2 | pause << 1 | ! p->dontChangeLEDs;
+
+	if(status != p->statusShown)
+		c->dirty |= LAYER_BIT(LAYER_STATUS);
+	if(compose_redraw(c, LAYER_STATUS))
+	{
+		DRAW(executeLED, execute);
+		DRAW(pauseLED, pause);
+		DRAW(runLED, ! p->dontChangeLEDs);
+		p->statusShown = status;
+	}
+}
+
+// One step of a panel's mode logic, run by the worker pool.  Phase 0
+// draws the next frame and returns how long it stays up; phase 1 checks
+// the buttons, blanks the operation LEDs and returns how long they stay
+// dark.  Both phases see the same configuration table.
+long deeper_step( struct panel *p )
+{
+  struct compositor *c = &p->comp;
+  struct layer *layer;
+  unsigned long varietyAmount;
+  int opKind;
+  int i;
+
+  if (! p->started)
   {
-    // blink the execute LED after every randomization
-    //STORE(executeLED, ! GET(executeLED));
-    STORE(executeLED, 1);
-    
+    p->started = 1;
+    p->lastKind = -1;
+    p->statusShown = -1;
+    p->x = 1;
+    p->y = 1;
+    p->shift_dir = 1;
+    // no grid and no seeds yet: the reseed count picks the next pattern
+    memset( &p->life, 0, sizeof p->life );
+  }
+
+  if (p->phase == 0)
+  {
+    // Take the configuration for this cycle, a reload swaps in a new one
+    // that takes effect with the next cycle
+    p->cfg = config_get();
+
 		// Use DF switches to control mode
-		deeperThoughMode = (GETSWITCHES(step) & 070)>>3;
-		
+		p->deeperThoughMode = (GETSWITCHES(step) & 070)>>3;
+
 		// Get IF switches value
-		swIfValue = (GETSWITCHES(step) & 07);
+		p->swIfValue = (GETSWITCHES(step) & 07);
+
+		// The configuration maps the DF and IF switches to a kind of mode
+		p->modeKind = p->cfg->mode[p->deeperThoughMode * 8 + p->swIfValue];
+
+		// The audio thread only drives the LEDs of its panel, in audio mode
+		if (p == audioPanel)
+			p->audioActive = audio_set_active(p->modeKind == MODE_AUDIO);
 
     // if we're paused -- don't change the LEDs
-    if (! dontChangeLEDs)
+    if (! p->dontChangeLEDs)
     {
       // Maximum amount to delay between changes
       // least signifiant address lines control the maximum delay
       // all "up" -- maximum delay
       // all "down" -- minimal delay
-      //delayAmount  =  (GETSWITCHES(swregister) & 07) * 400000L;
-      delayAmount  =  ((GETSWITCHES(swregister) & 077)+1) * 50000L;
-      
+      //p->delayAmount  =  (GETSWITCHES(swregister) & 07) * 400000L;
+      p->delayAmount  =  ((GETSWITCHES(swregister) & 077)+1) * p->cfg->delay_unit;
+
       // How much to vary the above timing
       // the next bank of three address lines control how much
-      // we can shorten the maximum delay 
+      // we can shorten the maximum delay
       // all "up" -- we can shorten to zero seconds
-      // all "down" -- must use maximum time before we change 
-      //varietyMult = (GETSWITCHES(swregister) & 070)>>3;
-      varietyMult = (GETSWITCHES(swregister) & 07700)>>6;
-      //varietyAmount = (unsigned long) (((rand() & delayAmount) / 7.0f) * varietyMult);
-      varietyAmount = (unsigned long) (((rand() % delayAmount) / 63.0f) * varietyMult);
-
-      sleepTime = delayAmount - varietyAmount;
-      
-      // In future revisions, we'll have different randomization sequences
-      switch(deeperThoughMode)
+      // all "down" -- must use maximum time before we change
+      //p->varietyMult = (GETSWITCHES(swregister) & 070)>>3;
+      p->varietyMult = (GETSWITCHES(swregister) & 07700)>>6;
+      //varietyAmount = (unsigned long) (((rand() & p->delayAmount) / 7.0f) * p->varietyMult);
+      varietyAmount = (unsigned long) (((rand() % p->delayAmount) / 63.0f) * p->varietyMult);
+
+      p->sleepTime = p->delayAmount - varietyAmount;
+
+      // Override Sleep Time: 0.5 second by default for the clock,
+      // IF switches select 10Hz to 50Hz for the system load
+      if(p->modeKind == MODE_CLOCK)
+        p->sleepTime = p->cfg->clock_delay;
+      else if(p->modeKind == MODE_SYSLOAD)
+        p->sleepTime = 7000000L / (70 + 40 * p->swIfValue);
+
+      // Redraw the layers that changed, bottom to top
+      mark_layers(p);
+      if(compose_redraw(c, LAYER_BASE))
+        draw_base(p, &c->layer[LAYER_BASE]);
+      if(compose_redraw(c, LAYER_ANIMATION))
+        draw_snake(p, &c->layer[LAYER_ANIMATION]);
+      if(compose_redraw(c, LAYER_CLOCK))
       {
-		  case 3:	// 011 = Most LEDs Off
-			STORE(programCounter,    0);
-			STORE(memoryAddress,     0);
-			STORE(memoryBuffer,      0);
-			STORE(accumulator,       0);
-			STORE(multiplierQuotient,0);
-			STORE(stepCounter,       0);
-			STORE(dataField,         0);
-			STORE(instField,         0);
-			// Randomly blink first column of operation LEDs
-			STORE(andLED, rand_flag(100,20));
-			STORE(tadLED, rand_flag(100,2));
-			STORE(iszLED, rand_flag(100,5));
-			STORE(dcaLED, rand_flag(100,5));
-			STORE(jmsLED, rand_flag(100,5));
-			STORE(jmpLED, rand_flag(100,15));
-			STORE(iotLED, rand_flag(100,10));
-			STORE(oprLED, rand_flag(100,10));
-			STORE(linkLED, 0);
-			STORE(deferLED, 0);
-			STORE(wordCountLED, 0);
-			STORE(currentAddressLED, 0);
-			STORE(breakLED, 0);
-			STORE(ionLED,     0);
-			STORE(fetchLED,   0);
-			break;
-		  case 0:	// 000 = ALL LEDS ON
-			STORE(programCounter,    65535 & programCounter[2]);
-			STORE(memoryAddress,     65535 & memoryAddress[2]);
-			STORE(memoryBuffer,      65535 & memoryBuffer[2]);
-			STORE(accumulator,       65535 & accumulator[2]);
-			STORE(multiplierQuotient,65535 & multiplierQuotient[2]);
-			STORE(stepCounter,       65535 & stepCounter[2]);
-			STORE(dataField,         65535 & dataField[2]);
-			STORE(instField,         65535 & instField[2]);
-			STORE(andLED, 1);
-			STORE(tadLED, 1);
-			STORE(iszLED, 1);
-			STORE(dcaLED, 1);
-			STORE(jmsLED, 1);
-			STORE(jmpLED, 1);
-			STORE(iotLED, 1);
-			STORE(oprLED, 1);
-			STORE(pauseLED, 1);
-			STORE(linkLED, 1);
-			STORE(deferLED, 1);
-			STORE(wordCountLED, 1);
-			STORE(currentAddressLED, 1);
-			STORE(breakLED, 1);
-			STORE(ionLED,     1);
-			STORE(fetchLED,   1);
-			break;
-		  case 6:	// 110 = Binary Clock
-			currentTime = time(NULL);
-			localTime = localtime(&currentTime);
-			hour = localTime->tm_hour;
-			min = localTime->tm_min;
-			sec = localTime->tm_sec;
-						
-			STORE(programCounter,    hour);
-			STORE(memoryAddress,     min);
-			STORE(memoryBuffer,      sec);
-			STORE(accumulator,       (localTime->tm_mon + 1));
-			STORE(multiplierQuotient,localTime->tm_mday);
-			STORE(stepCounter,       0);
-			STORE(dataField,         0);
-			STORE(instField,         0);
-			//STORE(linkLED, rand_flag(100,20));
-			STORE(deferLED, 0);
-			STORE(wordCountLED, 0);
-			STORE(currentAddressLED, 0);
-			STORE(breakLED, 0);
-			STORE(ionLED,     1);
-			STORE(fetchLED,   1);
-			// Randomly blink first column of operation LEDs
-			STORE(andLED, rand_flag(100,50));
-			STORE(tadLED, rand_flag(100,5));
-			STORE(iszLED, rand_flag(100,10));
-			STORE(dcaLED, rand_flag(100,10));
-			STORE(jmsLED, rand_flag(100,10));
-			STORE(jmpLED, rand_flag(100,30));
-			STORE(iotLED, rand_flag(100,20));
-			STORE(oprLED, rand_flag(100,20));
-			// Override Sleep Time to 0.5 second
-			sleepTime = 500000;
-			break;
-		  case 5:	// 101 = Fewer Random LEDs						
-			STORE(programCounter,    rand() & programCounter[2]);
-			STORE(memoryAddress,     rand() & memoryAddress[2]);
-			STORE(memoryBuffer,      rand() & memoryBuffer[2]);
-			STORE(accumulator,       0);
-			STORE(multiplierQuotient,0);
-			STORE(stepCounter,       0);
-			STORE(dataField,         0);
-			STORE(instField,         0);
-			//STORE(linkLED, rand_flag(100,20));
-			STORE(deferLED, 0);
-			STORE(wordCountLED, 0);
-			STORE(currentAddressLED, 0);
-			STORE(breakLED, 0);
-			STORE(ionLED,     1);
-			STORE(fetchLED,   1);
-			// Randomly blink first column of operation LEDs
-			STORE(andLED, rand_flag(100,50));
-			STORE(tadLED, rand_flag(100,5));
-			STORE(iszLED, rand_flag(100,10));
-			STORE(dcaLED, rand_flag(100,10));
-			STORE(jmsLED, rand_flag(100,10));
-			STORE(jmpLED, rand_flag(100,30));
-			STORE(iotLED, rand_flag(100,20));
-			STORE(oprLED, rand_flag(100,20));
-			break;			
-		  case 1:	// 001 = Snake
-			switch(y)
-			{
-				case 1:
-					STORE(programCounter, 	 x & programCounter[2]);
-					STORE(memoryAddress,     0);
-					STORE(memoryBuffer,      0);
-					STORE(accumulator,       0);
-					STORE(multiplierQuotient,0);
-					break;
-				case 2:
-					STORE(programCounter, 	 0);
-					STORE(memoryAddress,     x & memoryAddress[2]);
-					STORE(memoryBuffer,      0);
-					STORE(accumulator,       0);
-					STORE(multiplierQuotient,0);
-					break;
-				case 3:
-					STORE(programCounter, 	 0);
-					STORE(memoryAddress,     0);
-					STORE(memoryBuffer,      x & memoryBuffer[2]);
-					STORE(accumulator,       0);
-					STORE(multiplierQuotient,0);
-					break;
-				case 4:
-					STORE(programCounter, 	 0);
-					STORE(memoryAddress,     0);
-					STORE(memoryBuffer,      0);
-					STORE(accumulator,       x & accumulator[2]);
-					STORE(multiplierQuotient,0);
-					break;
-				case 5:
-					STORE(programCounter, 	 0);
-					STORE(memoryAddress,     0);
-					STORE(memoryBuffer,      0);
-					STORE(accumulator,       0);
-					STORE(multiplierQuotient, x & multiplierQuotient[2]);
-					break;
-				default:
-					y = 1;
-			}
-			if(shift_dir == 1 && x < 14336)
-			{
-				x = x << 1;
-				if(x < 7)
-					x += 1;
-			}
-			else if(shift_dir == 0 && x > 1)
-			{
-				x = x >> 1;
-			}
-			else
-			{
-				shift_dir = !shift_dir;
-				y++;
-			}
-			
-			
-			STORE(stepCounter,       0);
-			STORE(dataField,         0);
-			STORE(instField,         0);
-			STORE(linkLED, 0);
-			STORE(deferLED, 0);
-			STORE(wordCountLED, 0);
-			STORE(currentAddressLED, 0);
-			STORE(breakLED, 0);
-			STORE(ionLED,     1);
-			STORE(fetchLED,   1);
-			// Randomly blink first column of operation LEDs
-			STORE(andLED, rand_flag(100,50));
-			STORE(tadLED, rand_flag(100,10));
-			STORE(iszLED, rand_flag(100,20));
-			STORE(dcaLED, rand_flag(100,20));
-			STORE(jmsLED, rand_flag(100,20));
-			STORE(jmpLED, rand_flag(100,60));
-			STORE(iotLED, rand_flag(100,40));
-			STORE(oprLED, rand_flag(100,40));
-			break;
-			
-			break;
-			
-		  default:
-			STORE(programCounter,    rand() & programCounter[2]);
-			STORE(memoryAddress,     rand() & memoryAddress[2]);
-			STORE(memoryBuffer,      rand() & memoryBuffer[2]);
-			STORE(accumulator,       rand() & accumulator[2]);
-			STORE(multiplierQuotient,rand() & multiplierQuotient[2]);
-			STORE(stepCounter,       rand() & stepCounter[2]);
-			STORE(dataField,         rand() & dataField[2]);
-			STORE(instField,         rand() & instField[2]);
-			STORE(linkLED, rand_flag(100,20));
-			STORE(deferLED, 0);
-			STORE(wordCountLED, 0);
-			STORE(currentAddressLED, 0);
-			STORE(breakLED, 0);
-			STORE(ionLED,     1);
-			STORE(fetchLED,   1);
-			// Randomly blink first column of operation LEDs
-			STORE(andLED, rand_flag(100,50));
-			STORE(tadLED, rand_flag(100,10));
-			STORE(iszLED, rand_flag(100,20));
-			STORE(dcaLED, rand_flag(100,20));
-			STORE(jmsLED, rand_flag(100,20));
-			STORE(jmpLED, rand_flag(100,60));
-			STORE(iotLED, rand_flag(100,40));
-			STORE(oprLED, rand_flag(100,40));
-			break;
+        p->clockShown = time(NULL);
+        draw_clock(p, &c->layer[LAYER_CLOCK], p->clockShown);
       }
+      if(compose_redraw(c, LAYER_OPLEDS))
+      {
+        // Randomly blink first column of operation LEDs, as busy as the
+        // CPUs are in the system load mode; audio without a source
+        // falls back to the normal mode
+        opKind = p->modeKind == MODE_AUDIO ? MODE_NORMAL : p->modeKind;
+        store_random_opleds(&c->layer[LAYER_OPLEDS], &p->cfg->kind[opKind],
+                            p->modeKind == MODE_SYSLOAD ? p->load.cpu_total : 100);
+      }
+      p->lastKind = p->modeKind;
     }
     else
     {
-		sleepTime = 250 * 1000;
+		p->sleepTime = p->cfg->pause_delay;
 	}
 
-	// Subtract the delay added below
-	if(sleepTime > opled_delay)
-		sleepTime = sleepTime - opled_delay;
+    // blink the execute LED after every randomization
+    draw_status(p, 1);
+    if(compose(c, p->ledstatus))
+      multiplex_wake(p);
+    mirror_publish(p->ledstatus);	// a whole frame, and the switches read for it
+
+	// Subtract the delay added below.  The system load refreshes up to
+	// 50Hz, faster than opled_delay allows for, so there the operation
+	// LEDs are dark for at most half of the cycle.
+	p->opledDelay = p->cfg->opled_delay;
+	if(p->modeKind == MODE_SYSLOAD && p->opledDelay > p->sleepTime / 2)
+		p->opledDelay = p->sleepTime / 2;
+	if(p->sleepTime > p->opledDelay)
+		p->sleepTime = p->sleepTime - p->opledDelay;
 	else
-		sleepTime = 0;
+		p->sleepTime = 0;
 
 	// Output Console when register switches change
-	if(swRegValue != GETSWITCHES(swregister))
+	if(p->swRegValue != GETSWITCHES(swregister))
 	{
-		swRegValue = GETSWITCHES(swregister);
-		printf("Register Switch: Value=%lu  delay=%lu  varietyMult=%lu \n", swRegValue, delayAmount, varietyMult);
-		
+		p->swRegValue = GETSWITCHES(swregister);
+		if (! p->quiet)
+			log_info("Register Switch: Value=%lu  delay=%lu  varietyMult=%lu", p->swRegValue, p->delayAmount, p->varietyMult);
 	}
 
 	// Output Console when register switches change
-	if(swStepValue != GETSWITCHES(step))
+	if(p->swStepValue != GETSWITCHES(step))
 	{
-		swStepValue = GETSWITCHES(step);
-		printf("Step Switch: Value=%lu  Mode=%i  IF Value=%i\n", swStepValue, deeperThoughMode, swIfValue);
-		
+		p->swStepValue = GETSWITCHES(step);
+		if (! p->quiet)
+			log_info("Step Switch: Value=%lu  Mode=%i  IF Value=%i", p->swStepValue, p->deeperThoughMode, p->swIfValue);
 	}
-	
+
 	// Random Delay
-    usleep(sleepTime);
+	p->phase = 1;
+	return p->sleepTime;
+  }
 
     // if the stop switch is held for > 3 seconds, then clean up nicely
     if (GETSWITCH(stop))
     {
-		stopPressedTime = (unsigned long)(stopPressedTime + ((sleepTime + opled_delay) / 1000.0f));
-		if(stopPressedTime > 3000)
+		p->stopPressedTime = (unsigned long)(p->stopPressedTime + ((p->sleepTime + p->opledDelay) / 1000.0f));
+		if(p->stopPressedTime > 3000)
 		{
-			//if(swIfValue==0)
+			//if(p->swIfValue==0)
 			if(GETSWITCH(singStep) && GETSWITCH(singInst))
 			{
 				system("shutdown --poweroff now");
@@ -560,16 +790,16 @@ int main( int argc, char *argv[] )
 	}
 	else
 	{
-		stopPressedTime = 0;
+		p->stopPressedTime = 0;
 	}
 
     // if the start switch is held for > 3 seconds, and both Sing switchs are down, reboot system
     if (GETSWITCH(start))
     {
-		startPressedTime = (unsigned long)(startPressedTime + ((sleepTime + opled_delay) / 1000.0f));
-		if(startPressedTime > 3000)
+		p->startPressedTime = (unsigned long)(p->startPressedTime + ((p->sleepTime + p->opledDelay) / 1000.0f));
+		if(p->startPressedTime > 3000)
 		{
-			//if(swIfValue==0)
+			//if(p->swIfValue==0)
 			if(GETSWITCH(singStep) && GETSWITCH(singInst))
 			{
 				system("reboot");
@@ -578,31 +808,168 @@ int main( int argc, char *argv[] )
 	}
 	else
 	{
-		startPressedTime = 0;
+		p->startPressedTime = 0;
 	}
-	
+
     // if one of the single step switches is selected, then "pause" and don't change the LED display
     // otherwise "run"
-    dontChangeLEDs = GETSWITCH(singStep) || GETSWITCH(singInst);
-    STORE(pauseLED, dontChangeLEDs);
-    STORE(runLED, ! dontChangeLEDs);
-    
-    // Turn operation LEDs off for 10ms to create a fast blink
-    STORE(executeLED, 0);
-    STORE(andLED, 0);
-    STORE(tadLED, 0);
-    STORE(iszLED, 0);
-    STORE(dcaLED, 0);
-    STORE(jmsLED, 0);
-    STORE(jmpLED, 0);
-    STORE(iotLED, 0);
-    STORE(oprLED, 0);
-    usleep(opled_delay);
- }
+    p->dontChangeLEDs = GETSWITCH(singStep) || GETSWITCH(singInst);
+    draw_status(p, 0);
+
+    // Turn operation LEDs off for 10ms to create a fast blink, the link
+    // LED stays as it is (in audio mode the layer is not shown)
+    layer = &c->layer[LAYER_OPLEDS];
+    for (i = 0; i < CONFIG_OPLEDS; i++)
+      DRAW(opLEDs[i], 0);
+    c->changed |= LAYER_BIT(LAYER_OPLEDS);
+    if(compose(c, p->ledstatus))
+      multiplex_wake(p);
+    mirror_publish(p->ledstatus);
+
+    config_put(p->cfg);
+    p->phase = 0;
+    return p->opledDelay;
+}
+
+
+int main( int argc, char *argv[] )
+{
+  static struct panel front;
+  struct panel *panels[1] = { &front };
+  struct multiplex mux;
+  pthread_t     thread1;
+  int           iret1;
+  const char   *configPath = CONFIG_DEFAULT_PATH;
+  const char   *audioSource = NULL;
+  const char   *mirrorDest = NULL;
+  int           panelId = 0;
+  const char   *bench = NULL;
+  const char   *logSink = NULL;
+  int           logLevel = LOG_LEVEL_INFO;
+  int audioRate = AUDIO_DEFAULT_RATE;
+  int audioChannels = AUDIO_DEFAULT_CHANNELS;
+  int opt;
+
+  while( (opt = getopt(argc, argv, "f:a:r:c:m:i:l:vb:")) != -1 )
+  {
+    switch( opt )
+    {
+      case 'f':
+        configPath = optarg;
+        break;
+      case 'a':
+        audioSource = optarg;
+        break;
+      case 'r':
+        audioRate = atoi(optarg);
+        break;
+      case 'c':
+        audioChannels = atoi(optarg);
+        break;
+      case 'm':
+        mirrorDest = optarg;
+        break;
+      case 'i':
+        panelId = atoi(optarg);
+        break;
+      case 'l':
+        logSink = optarg;
+        break;
+      case 'v':
+        logLevel = LOG_LEVEL_DEBUG;
+        break;
+      case 'b':
+        bench = optarg;
+        break;
+      default:
+        usage( argv[0] );
+    }
+  }
+
+  if( bench )
+  {
+    if( strcmp(bench, "audio") == 0 )
+      exit( audio_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "mirror") == 0 )
+      exit( mirror_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "life") == 0 )
+      exit( life_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "compose") == 0 )
+      exit( compose_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "log") == 0 )
+      exit( log_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "delay") == 0 )
+      exit( delay_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "sysload") == 0 )
+      exit( sysload_bench() ? EXIT_FAILURE : EXIT_SUCCESS );
+    if( strcmp(bench, "panels") == 0 )
+    {
+      config_start( configPath );
+      sysloadOk = sysload_open() == 0;
+      exit( sim_bench(deeper_step) ? EXIT_FAILURE : EXIT_SUCCESS );
+    }
+    if( strcmp(bench, "park") == 0 )
+    {
+      config_start( configPath );
+      exit( park_bench(deeper_step) ? EXIT_FAILURE : EXIT_SUCCESS );
+    }
+    usage( argv[0] );
+  }
+
+  // from here on nothing writes to the console directly, a stalled
+  // console must not hold up the panel
+  if( log_start(logSink, logLevel) )
+    exit( EXIT_FAILURE );
+
+  // a broken file is reported and the built-in values are used
+  config_start( configPath );
+
+  // install handler to terminate future thread
+  if( signal(SIGINT, sig_handler) == SIG_ERR )
+    {
+      fprintf( stderr, "Failed to install SIGINT handler.\n" );
+      exit( EXIT_FAILURE );
+    }
+
+  // the PiDP-8 itself
+  front.id = panelId;
+  front.backend = &gpio_backend;
+  audioPanel = &front;
+
+  memset( &mux, 0, sizeof mux );
+  mux.panels = panels;
+  mux.npanels = 1;
+  mux.terminate = &terminate;
+
+  // create thread
+  iret1 = pthread_create( &thread1, NULL, blink, &mux );
+
+  if( iret1 )
+    {
+      fprintf( stderr, "Error creating thread, return code %d\n", iret1 );
+      exit( EXIT_FAILURE );
+    }
+
+  sleep( 2 );			// allow 2 sec for multiplex to start
+
+  if( audioSource && audio_start(audioSource, audioRate, audioChannels, show_audio_frame) )
+    log_warn( "Failed to open audio source %s, 010 mode disabled", audioSource );
+
+  if( mirrorDest && mirror_start(mirrorDest, front.id, front.ledstatus, front.switchstatus) )
+    log_warn( "Failed to start mirroring to %s", mirrorDest );
+
+  sysloadOk = sysload_open() == 0;
+
+  srand(time(NULL));
+
+  // run the mode logic until CTRL-C or the stop switch
+  pool_run( panels, 1, 1, deeper_step, &terminate );
 
 
   if( pthread_join(thread1, NULL) )
-    printf( "\r\nError joining multiplex thread\r\n" );
+    log_error( "Error joining multiplex thread" );
+
+  log_stop();
 
   return 0;
 }
@@ -0,0 +1,174 @@
+/*
+ * delay.c: calibrated short delays for the multiplexer
+ *
+ * usleep(1) and usleep(10) go through the scheduler and really wait for
+ * tens of microseconds, and nanosleep(3us) is no better.  For settle
+ * times of a few microseconds the multiplexer spins on the monotonic
+ * clock instead (a vDSO call, no syscall); only waits long enough to
+ * hide the sleep overshoot are slept, ending early by the mean overshoot.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "delay.h"
+
+#define SPIN_MAX_CAP_NS		50000	// never spin longer than this
+#define CALIBRATE_ROUNDS	200
+
+struct delay_calibration delay_cal = {
+	.clock_ns = 100,
+	.sleep_ns = 60000,
+	.sleep_max_ns = 60000,
+	.spin_max_ns = SPIN_MAX_CAP_NS,
+	.spin_err_ns = 0,
+};
+
+uint64_t delay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+double delay_sec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000ull;
+	ts.tv_nsec = deadline % 1000000000ull;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+		;
+}
+
+void delay_ns(long ns)
+{
+	uint64_t deadline = delay_now() + ns;
+
+	// wake up early by the mean overshoot, so the mean wait is right
+	if (ns > delay_cal.spin_max_ns)
+		sleep_until(deadline - delay_cal.sleep_ns);
+	else
+		while (delay_now() < deadline)
+			;
+}
+
+
+// PART 1 - calibration ------------------------------------------------
+
+// Worst overshoot of spinning for ns
+static long spin_error(long ns)
+{
+	uint64_t start;
+	long err, worst = 0;
+	int i;
+
+	for (i = 0; i < CALIBRATE_ROUNDS; i++)
+	{
+		start = delay_now();
+		while (delay_now() < start + ns)
+			;
+		err = (long)(delay_now() - start) - ns;
+		if (err > worst)
+			worst = err;
+	}
+	return worst;
+}
+
+void delay_calibrate(void)
+{
+	uint64_t start, t;
+	long over, sum = 0, worst = 0;
+	int i;
+
+	start = delay_now();
+	for (i = 0; i < 10000; i++)
+		t = delay_now();
+	delay_cal.clock_ns = (long)(t - start) / 10000;
+
+	for (i = 0; i < CALIBRATE_ROUNDS / 4; i++)
+	{
+		start = delay_now();
+		sleep_until(start + 1000);
+		over = (long)(delay_now() - start) - 1000;
+		sum += over;
+		if (over > worst)
+			worst = over;
+	}
+	delay_cal.sleep_ns = sum / (CALIBRATE_ROUNDS / 4);
+	delay_cal.sleep_max_ns = worst;
+
+	// spinning is cheaper than a sleep that overshoots by as much again
+	delay_cal.spin_max_ns = 2 * delay_cal.sleep_ns;
+	if (delay_cal.spin_max_ns > SPIN_MAX_CAP_NS)
+		delay_cal.spin_max_ns = SPIN_MAX_CAP_NS;
+	if (delay_cal.spin_max_ns < 1000)
+		delay_cal.spin_max_ns = 1000;
+
+	delay_cal.spin_err_ns = spin_error(1000);
+}
+
+
+// PART 2 - benchmark --------------------------------------------------
+
+// Mean length in ns of a wait function
+static long measure(void (*wait)(long), long arg)
+{
+	uint64_t start = delay_now();
+	int i;
+
+	for (i = 0; i < CALIBRATE_ROUNDS; i++)
+		wait(arg);
+	return (long)(delay_now() - start) / CALIBRATE_ROUNDS;
+}
+
+static void wait_usleep(long us)
+{
+	usleep(us);
+}
+
+static void wait_short(long unused)
+{
+	(void)unused;
+	fflush(stdout);
+	usleep(1);
+}
+
+static void wait_nanosleep(long ns)
+{
+	nanosleep((struct timespec[]){{0, ns}}, NULL);
+}
+
+int delay_bench(void)
+{
+	static const long spins[] = { 250, 500, 1000, 2000, 5000, 10000 };
+	unsigned i;
+
+	delay_calibrate();
+	printf("delay: clock read %ld ns, shortest sleep overshoots %ld ns (worst %ld ns)\n",
+	       delay_cal.clock_ns, delay_cal.sleep_ns, delay_cal.sleep_max_ns);
+	printf("delay: waits up to %ld ns spin\n", delay_cal.spin_max_ns);
+	for (i = 0; i < sizeof spins / sizeof spins[0]; i++)
+		printf("delay: spin %6ld ns  worst overshoot %5ld ns\n", spins[i], spin_error(spins[i]));
+	printf("delay: old waits as measured, new waits spun for the same times\n");
+	printf("delay: short_wait()      %6ld ns   delay_ns(%d)   %6ld ns\n",
+	       measure(wait_short, 0), DELAY_CLOCK_NS, measure(delay_ns, DELAY_CLOCK_NS));
+	printf("delay: usleep(10)        %6ld ns   delay_ns(%d)  %6ld ns\n",
+	       measure(wait_usleep, 10), DELAY_ROW_OFF_NS, measure(delay_ns, DELAY_ROW_OFF_NS));
+	printf("delay: nanosleep(3000)   %6ld ns   delay_ns(%d)   %6ld ns\n",
+	       measure(wait_nanosleep, 3000), DELAY_SETTLE_NS, measure(delay_ns, DELAY_SETTLE_NS));
+	printf("delay: per frame (8 row offs + 3 switch rows) %ld us saved\n",
+	       (8 * (measure(wait_usleep, 10) - DELAY_ROW_OFF_NS) +
+		3 * (measure(wait_nanosleep, 3000) - DELAY_SETTLE_NS)) / 1000);
+	return 0;
+}
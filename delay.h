@@ -0,0 +1,43 @@
+/*
+ * delay.h: calibrated short delays for the multiplexer
+ *
+ * Waits shorter than a few tens of microseconds spin on the monotonic
+ * clock, longer ones sleep until an absolute deadline.  delay_calibrate()
+ * measures what a clock read and the shortest sleep really cost on this
+ * board, which decides where spinning ends and sleeping begins.
+ */
+
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdint.h>
+#include <time.h>
+
+// The old usleep(10) and nanosleep(3us) waits, now met instead of overshot
+#define DELAY_SETTLE_NS		3000	// switch row driven to columns readable
+#define DELAY_ROW_OFF_NS	10000	// LED row released to next row (UDN2981 ghosting)
+#define DELAY_CLOCK_NS		1000	// between clocked GPIO changes (150 cycles)
+
+struct delay_calibration {
+	long clock_ns;			// cost of one clock read
+	long sleep_ns;			// mean overshoot of the shortest sleep
+	long sleep_max_ns;		// worst overshoot seen
+	long spin_max_ns;		// waits up to this long spin
+	long spin_err_ns;		// worst overshoot of a 1us spin
+};
+
+extern struct delay_calibration delay_cal;
+
+uint64_t delay_now(void);		// ns, CLOCK_MONOTONIC
+double   delay_sec(clockid_t clock);	// s on any clock, for the benchmarks
+
+// Measure the clock and sleep costs.  Call once before the first delay_ns.
+void delay_calibrate(void);
+
+// Wait ns nanoseconds, spinning or sleeping as calibrated
+void delay_ns(long ns);
+
+// Report calibration and accuracy next to the waits they replace
+int delay_bench(void);
+
+#endif
@@ -4,8 +4,15 @@
  * www.obsolescenceguaranteed.blogspot.com
  * 
  * The only communication with the main program (simh):
- * - external variable ledstatus is read to determine which leds to light.
- * - external variable switchstatus is updated with current switch settings.
+ * - each panel's ledstatus is read to determine which leds to light.
+ * - each panel's switchstatus is updated with current switch settings.
+ * 
+ * The PiDP-8 itself is the gpio backend; any number of other panels
+ * (see sim.c) are multiplexed in the same time slots.
+ * 
+ * When all panels are dark the thread parks: it reads the switches at
+ * MULTIPLEX_POLL_HZ and sleeps on a futex in between, so a blank panel
+ * costs next to no CPU.  Publishing a lit frame wakes it at once.
  * 
 */
 
@@ -14,10 +21,17 @@
 //#define SERIALSETUP
 
 
+#include <errno.h>
 #include <time.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "delay.h"
 #include "gpio.h"
+#include "log.h"
+#include "panel.h"
 
 typedef unsigned int    uint32; 
 typedef signed int      int32; 
@@ -31,9 +45,6 @@ struct bcm2835_peripheral gpio;	// needs initialisation
 
 long intervl = 300000;		// light each row of leds this long
 
-uint32 switchstatus[3] = { 0 }; // bitfields: 3 rows of up to 12 switches
-uint32 ledstatus[8] = { 0 };	// bitfields: 8 ledrows of up to 12 LEDs
-
 // PART 1 - GPIO and RT process stuff ----------------------------------
 
 // GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x)
@@ -45,6 +56,7 @@ uint32 ledstatus[8] = { 0 };	// bitfields: 8 ledrows of up to 12 LEDs
 #define GPIO_CLR  *(gpio.addr + 10) // clears bits which are 1 ignores bits which are 0
  
 #define GPIO_READ(g)  *(gpio.addr + 13) &= (1<<(g))
+#define GPIO_LEV      *(gpio.addr + 13) // pin levels, read only
 
 #define GPIO_PULL *(gpio.addr + 37) // pull up/pull down
 #define GPIO_PULLCLK0 *(gpio.addr + 38) // pull up/pull down clock
@@ -54,7 +66,7 @@ uint32 ledstatus[8] = { 0 };	// bitfields: 8 ledrows of up to 12 LEDs
 int map_peripheral(struct bcm2835_peripheral *p)
 {
    if ((p->mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-      printf("Failed to open /dev/mem, try checking permissions.\n");
+      log_error("Failed to open /dev/mem, try checking permissions.");
       return -1;
    }
    p->map = mmap(
@@ -62,7 +74,7 @@ int map_peripheral(struct bcm2835_peripheral *p)
       p->mem_fd,      	// File descriptor to physical memory virtual file '/dev/mem'
       p->addr_p);       // Address in physical map that we want this memory block to expose
    if (p->map == MAP_FAILED) {
-        perror("mmap");
+        log_error("mmap: %s", strerror(errno));
         return -1;
    }
    p->addr = (volatile unsigned int *)p->map;
@@ -87,24 +99,22 @@ uint8_t cols[] = {13, 12, 11,    10, 9, 8,    7, 6, 5,    4, 15, 14};
 #endif
 
 
-void *blink(int *terminate)
+// PART 3 - the GPIO panel backend ------------------------------------
+
+static int gpio_open(struct panel *p)
 {
-	int i,j,k,switchscan, tmp;
+	int i;
+
+	(void)p;
 
 	// Find gpio address (different for Pi 2) ----------
 	gpio.addr_p = bcm_host_get_peripheral_address() +  + 0x200000;
-	if (gpio.addr_p== 0x20200000) printf("RPi Plus detected\n");
-	else printf("RPi 2 detected\n");
+	if (gpio.addr_p== 0x20200000) log_info("RPi Plus detected");
+	else log_info("RPi 2 detected");
 
-	// set thread to real time priority -----------------
-	struct sched_param sp;
-	sp.sched_priority = 98; // maybe 99, 32, 31?
-	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
-	{ fprintf(stderr, "warning: failed to set RT priority\n"); }
-	// --------------------------------------------------
 	if(map_peripheral(&gpio) == -1) 
-	{	printf("Failed to map the physical GPIO registers into the virtual memory space.\n");
-		return (void *)-1;
+	{	log_error("Failed to map the physical GPIO registers into the virtual memory space.");
+		return -1;
 	}
 
 	// initialise GPIO (all pins used as inputs, with pull-ups enabled on cols)
@@ -159,73 +169,253 @@ void *blink(int *terminate)
 	short_wait(); // probably unnecessary
 	// --------------------------------------------------
 
-	//printf("\nFP on\n");
+	return 0;
+}
 
-	while(*terminate==0)
-	{
-		// prepare for lighting LEDs by setting col pins to output
-		for (i=0;i<12;i++)
-		{	INP_GPIO(cols[i]);			//
-			OUT_GPIO(cols[i]);			// Define cols as output
-		}
-		
-		// light up 8 rows of 12 LEDs each
+static void gpio_close(struct panel *p)
+{
+	(void)p;
+	// at this stage, all cols, rows, ledrows are set to input, so elegant way of closing down.
+	unmap_peripheral(&gpio);
+}
+
+static void gpio_leds_begin(struct panel *p)
+{
+	int i;
+
+	(void)p;
+	// prepare for lighting LEDs by setting col pins to output
+	for (i=0;i<12;i++)
+	{	INP_GPIO(cols[i]);			//
+		OUT_GPIO(cols[i]);			// Define cols as output
+	}
+}
+
+static void gpio_row_on(struct panel *p, int i, uint32_t leds)
+{
+	int k;
+
+	(void)p;
+	// Toggle columns for this ledrow (which LEDs should be on (CLR = on))
+	for (k=0;k<12;k++)
+	{	if ((leds&(1<<k))==0)
+			GPIO_SET = 1 << cols[k];
+		else 
+			GPIO_CLR = 1 << cols[k];
+	}	
+
+	// Toggle this ledrow on
+	INP_GPIO(ledrows[i]);	
+	GPIO_SET = 1 << ledrows[i]; // test for flash problem
+	OUT_GPIO(ledrows[i]);
+//test	GPIO_SET = 1 << ledrows[i];
+}
+
+static void gpio_row_off(struct panel *p, int i)
+{
+	(void)p;
+	// Toggle ledrow off
+	GPIO_CLR = 1 << ledrows[i]; // superstition
+	INP_GPIO(ledrows[i]);
+}
+
+static void gpio_switches_begin(struct panel *p)
+{
+	int i;
+
+	(void)p;
+	// prepare for reading switches		
+	for (i=0;i<12;i++)
+		INP_GPIO(cols[i]);			// flip columns to input. Need internal pull-ups enabled.
+}
+
+static void gpio_switch_row_on(struct panel *p, int i)
+{
+	(void)p;
+	INP_GPIO(rows[i]);//			GPIO_CLR = 1 << rows[i];	// and output 0V to overrule built-in pull-up from column input pin
+	OUT_GPIO(rows[i]);			// turn on one switch row
+	GPIO_CLR = 1 << rows[i];	// and output 0V to overrule built-in pull-up from column input pin
+}
+
+static uint32_t gpio_switch_row_read(struct panel *p, int i)
+{
+	int j, tmp;
+	uint32_t switchscan = 0;
+
+	(void)p;
+	for (j=0;j<12;j++)			// 12 switches in each row
+	{	tmp = GPIO_READ(cols[j]);
+	if (tmp!=0)
+			switchscan += 1<<j;
+	}
+	INP_GPIO(rows[i]);			// stop sinking current from this row of switches
+	return switchscan;
+}
+
+// The GPIO block is mapped once, so only one panel can use this backend
+const struct panel_backend gpio_backend = {
+	.name = "gpio",
+	.open = gpio_open,
+	.close = gpio_close,
+	.leds_begin = gpio_leds_begin,
+	.row_on = gpio_row_on,
+	.row_off = gpio_row_off,
+	.switches_begin = gpio_switches_begin,
+	.switch_row_on = gpio_switch_row_on,
+	.switch_row_read = gpio_switch_row_read,
+};
+
+
+// PART 4 - the multiplexer, driving every panel through its backend ---
+//
+// Row i of all panels is lit in the same time slot, so the refresh rate
+// does not drop as panels are added; only the work per slot grows.
+
+// Are all LEDs of all panels off?
+static int dark(struct multiplex *mux)
+{
+	int i,j;
+
+	for (j=0;j<mux->npanels;j++)
 		for (i=0;i<8;i++)
-		{
+			if (mux->panels[j]->ledstatus[i])
+				return 0;
+	return 1;
+}
+
+static void read_switches(struct multiplex *mux)
+{
+	struct panel **panels = mux->panels;
+	int n = mux->npanels;
+	int i,j;
+
+	for (j=0;j<n;j++)
+		panels[j]->backend->switches_begin(panels[j]);
+
+	// read three rows of switches
+	for (i=0;i<3;i++)
+	{
+		for (j=0;j<n;j++)
+			panels[j]->backend->switch_row_on(panels[j], i);
+
+		delay_ns(DELAY_SETTLE_NS);		// spun, nanosleep overshoots it
+
+		for (j=0;j<n;j++)
+			panels[j]->switchstatus[i] = panels[j]->backend->switch_row_read(panels[j], i);
+	}
+}
+
+// Read only the switches until a panel lights up again.  The wake count
+// is read before the LEDs are looked at: a frame published after that
+// changes the count, so the futex wait returns at once instead of
+// sleeping through it.
+static void park(struct multiplex *mux)
+{
+	struct timespec ts = { 0, 1000000000 / MULTIPLEX_POLL_HZ };
+	uint32_t wake;
+
+	mux->parks++;
+	__atomic_store_n(&mux->parked, 1, __ATOMIC_SEQ_CST);
+	while (*mux->terminate==0)
+	{
+		wake = __atomic_load_n(&mux->wake, __ATOMIC_SEQ_CST);
+		if (!dark(mux))
+			break;
+		syscall(SYS_futex, &mux->wake, FUTEX_WAIT_PRIVATE, wake, &ts, NULL, 0);
+		read_switches(mux);
+	}
+	__atomic_store_n(&mux->parked, 0, __ATOMIC_SEQ_CST);
+}
+
+void multiplex_wake(struct panel *p)
+{
+	struct multiplex *mux = p->mux;
+	int i;
+
+	// a dark frame needs no refresh, so the dark mode never wakes it
+	for (i=0;i<8;i++)
+		if (p->ledstatus[i])
+			break;
+	if (!mux || i == 8)
+		return;
+	__atomic_add_fetch(&mux->wake, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mux->parked, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &mux->wake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
 
-			// Toggle columns for this ledrow (which LEDs should be on (CLR = on))
-			for (k=0;k<12;k++)
-			{	if ((ledstatus[i]&(1<<k))==0)
-					GPIO_SET = 1 << cols[k];
-				else 
-					GPIO_CLR = 1 << cols[k];
-			}	
+void *blink(void *arg)
+{
+	struct multiplex *mux = arg;
+	struct panel **panels = mux->panels;
+	int n = mux->npanels;
+	int i,j;
+	uint64_t start, last = 0, period;
 
-			// Toggle this ledrow on
-			INP_GPIO(ledrows[i]);	
-			GPIO_SET = 1 << ledrows[i]; // test for flash problem
-			OUT_GPIO(ledrows[i]);
-//test			GPIO_SET = 1 << ledrows[i];
+	// set thread to real time priority -----------------
+	struct sched_param sp;
+	sp.sched_priority = 98; // maybe 99, 32, 31?
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
+	{ log_warn("failed to set RT priority"); }
+	// --------------------------------------------------
+	delay_calibrate();
+	log_debug("delay: clock read %ld ns, sleep overshoot %ld ns, spin up to %ld ns",
+		  delay_cal.clock_ns, delay_cal.sleep_ns, delay_cal.spin_max_ns);
+	for (j=0;j<n;j++)
+		panels[j]->mux = mux;
+	for (j=0;j<n;j++)
+		if (panels[j]->backend->open(panels[j]) == -1)
+		{	while (--j >= 0)
+				panels[j]->backend->close(panels[j]);
+			return (void *)-1;
+		}
 
+	//printf("\nFP on\n");
 
+	while(*mux->terminate==0)
+	{
+		if (dark(mux))
+		{	park(mux);
+			last = 0;	// the parked time is no refresh period
+			continue;
+		}
 
-			nanosleep ((struct timespec[]){{0, intervl}}, NULL);
-			
-			// Toggle ledrow off
-			GPIO_CLR = 1 << ledrows[i]; // superstition
-			INP_GPIO(ledrows[i]);
-usleep(10);  // waste of cpu cycles but may help against udn2981 ghosting, not flashes though
+		start = delay_now();
+		if (last)
+		{	period = start - last;
+			mux->period_sum += period;
+			mux->period_sumsq += (double)period * period;
+			if (period > mux->period_max)
+				mux->period_max = period;
+			if (period < mux->period_min || mux->period_min == 0)
+				mux->period_min = period;
+			mux->frames++;
 		}
+		last = start;
 
-//nanosleep ((struct timespec[]){{0, intervl}}, NULL); // test
+		for (j=0;j<n;j++)
+			panels[j]->backend->leds_begin(panels[j]);
 
-		// prepare for reading switches		
-		for (i=0;i<12;i++)
-			INP_GPIO(cols[i]);			// flip columns to input. Need internal pull-ups enabled.
-			
-		// read three rows of switches
-		for (i=0;i<3;i++)
+		// light up 8 rows of 12 LEDs each
+		for (i=0;i<8;i++)
 		{
-			INP_GPIO(rows[i]);//			GPIO_CLR = 1 << rows[i];	// and output 0V to overrule built-in pull-up from column input pin
-			OUT_GPIO(rows[i]);			// turn on one switch row
-			GPIO_CLR = 1 << rows[i];	// and output 0V to overrule built-in pull-up from column input pin
+			for (j=0;j<n;j++)
+				panels[j]->backend->row_on(panels[j], i, panels[j]->ledstatus[i]);
 
-			nanosleep ((struct timespec[]){{0, intervl/100}}, NULL); // probably unnecessary long wait, maybe put above this loop also
+			delay_ns(intervl);
 
-			switchscan=0;
-			for (j=0;j<12;j++)			// 12 switches in each row
-			{	tmp = GPIO_READ(cols[j]);
-			if (tmp!=0)
-					switchscan += 1<<j;
-			}
-			INP_GPIO(rows[i]);			// stop sinking current from this row of switches
-
-			switchstatus[i] = switchscan;
+			for (j=0;j<n;j++)
+				panels[j]->backend->row_off(panels[j], i);
+			delay_ns(DELAY_ROW_OFF_NS);	// against udn2981 ghosting, not flashes though
 		}
+
+//nanosleep ((struct timespec[]){{0, intervl}}, NULL); // test
+
+		read_switches(mux);
 	}
 
 	//printf("\nFP off\n");
-	// at this stage, all cols, rows, ledrows are set to input, so elegant way of closing down.
+	for (j=0;j<n;j++)
+		panels[j]->backend->close(panels[j]);
 
 	return 0; 
 }
@@ -233,12 +423,7 @@ usleep(10);  // waste of cpu cycles but may help against udn2981 ghosting, not f
 
 void short_wait(void)					// creates pause required in between clocked GPIO settings changes
 {
-//	int i;
-//	for (i=0; i<150; i++) {
-//		asm volatile("nop");
-//	}
-	fflush(stdout); //
-	usleep(1); // suggested as alternative for asm which c99 does not accept
+	delay_ns(DELAY_CLOCK_NS);	// 150 cycles of the slowest core clock is under 1us
 }
 
 
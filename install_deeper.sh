@@ -25,7 +25,11 @@ fi
 
 make
 cp deeper /usr/bin/
+cp deeper-rx /usr/bin/
 cp deeper.init /etc/init.d/deeper
+if [ ! -f /etc/deeper.conf ]; then
+	cp deeper.conf /etc/deeper.conf
+fi
 
 case "$1" in
  	"--no-autostart")
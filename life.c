@@ -0,0 +1,225 @@
+/*
+ * life.c: bit-parallel cellular automaton on the five 12 bit registers
+ *
+ * All 60 cells live in one 64 bit word.  The eight neighbour planes are
+ * the grid shifted by one column and/or one row (12 bits), with the
+ * cells that would cross an edge masked off or, with wrapping, rotated
+ * in from the other side.  A carry-save adder tree over the planes gives
+ * the neighbour count of every cell at once as four bit planes, and the
+ * rule is applied by comparing those planes with each count the rule
+ * uses.  A generation is a few dozen word operations and no per-cell
+ * work at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "life.h"
+#include "delay.h"
+
+#define ALL	((1ULL << (LIFE_ROWS * LIFE_COLS)) - 1)
+#define COL0	(ALL / 07777)			// bit 0 of every row
+#define COL11	(COL0 << (LIFE_COLS - 1))	// bit 11 of every row
+#define ROW0	07777ULL
+#define ROWLAST	(ROW0 << ((LIFE_ROWS - 1) * LIFE_COLS))
+
+const char *const life_presets[6] = {
+	"B36/S23",		// HighLife
+	"B2/S",			// Seeds
+	"B3678/S34678",		// Day & Night
+	"B1357/S1357",		// Replicator
+	"B368/S245",		// Morley
+	"B3/S12345",		// Maze
+};
+
+int life_parse_rule(const char *rule, uint16_t *birth, uint16_t *survive)
+{
+	uint16_t *set = NULL;
+
+	*birth = *survive = 0;
+	for (; *rule; rule++)
+	{
+		if (*rule == 'B' || *rule == 'b')
+			set = birth;
+		else if (*rule == 'S' || *rule == 's')
+			set = survive;
+		else if (*rule >= '0' && *rule <= '8' && set)
+			*set |= 1 << (*rule - '0');
+		else if (*rule != '/')
+			return -1;
+	}
+	return *birth & 1 ? -1 : 0;	// B0 would light the whole panel every other step
+}
+
+// Sum and carry of three bit planes
+#define FULL_ADD(s, c, a, b, d) { uint64_t t_ = (a) ^ (b); s = t_ ^ (d); c = ((a) & (b)) | (t_ & (d)); }
+
+uint64_t life_next(uint64_t g, uint16_t birth, uint16_t survive, int wrap)
+{
+	uint64_t l, r, n[8];
+	uint64_t s0, s1, s2, c0, c1, c2, c3, t, c4, c5;
+	uint64_t b0, b1, b2, b3, next = 0;
+	int i;
+
+	// the cells to the left and right of each cell
+	l = (g >> 1) & ~COL11;
+	r = (g << 1) & ~COL0 & ALL;
+	if (wrap)
+	{
+		l |= (g << (LIFE_COLS - 1)) & COL11;
+		r |= (g >> (LIFE_COLS - 1)) & COL0;
+	}
+
+	// the three cells of the rows below and above
+	n[0] = l;
+	n[1] = r;
+	n[2] = l >> LIFE_COLS;
+	n[3] = g >> LIFE_COLS;
+	n[4] = r >> LIFE_COLS;
+	n[5] = (l << LIFE_COLS) & ALL;
+	n[6] = (g << LIFE_COLS) & ALL;
+	n[7] = (r << LIFE_COLS) & ALL;
+	if (wrap)
+	{
+		int last = (LIFE_ROWS - 1) * LIFE_COLS;
+		n[2] |= (l & ROW0) << last;
+		n[3] |= (g & ROW0) << last;
+		n[4] |= (r & ROW0) << last;
+		n[5] |= (l & ROWLAST) >> last;
+		n[6] |= (g & ROWLAST) >> last;
+		n[7] |= (r & ROWLAST) >> last;
+	}
+
+	// carry-save adder tree: count = 8*b3 + 4*b2 + 2*b1 + b0
+	FULL_ADD(s0, c0, n[0], n[1], n[2]);
+	FULL_ADD(s1, c1, n[3], n[4], n[5]);
+	s2 = n[6] ^ n[7];
+	c2 = n[6] & n[7];
+	FULL_ADD(b0, c3, s0, s1, s2);
+	FULL_ADD(t, c4, c0, c1, c2);
+	b1 = t ^ c3;
+	c5 = t & c3;
+	b2 = c4 ^ c5;
+	b3 = c4 & c5;
+
+	for (i = 0; i <= 8; i++)
+	{
+		uint64_t eq, cells;
+
+		if (!((birth | survive) & (1 << i)))
+			continue;
+		eq = (i & 1 ? b0 : ~b0) & (i & 2 ? b1 : ~b1) &
+		     (i & 4 ? b2 : ~b2) & (i & 8 ? b3 : ~b3);
+		cells = 0;
+		if (birth & (1 << i))
+			cells |= ~g;
+		if (survive & (1 << i))
+			cells |= g;
+		next |= eq & cells;
+	}
+	return next & ALL;
+}
+
+// Spread the 12 switches over the grid with a xorshift generator, so the
+// same switch setting always gives the same start.  All down = random.
+void life_seed(struct life *l, uint16_t switches)
+{
+	uint64_t x = switches ? switches * 0x9e3779b97f4a7c15ULL : ((uint64_t)rand() << 32) ^ rand();
+
+	x |= 1;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	l->grid = (x ^ (x >> 29)) & ALL;
+	l->generation = 0;
+	l->seeds++;
+	memset(l->seen, 0, sizeof l->seen);
+}
+
+// Remember a state, return 1 if it was seen within LIFE_HISTORY generations.
+// With twice as many slots as remembered generations there is always an
+// empty or stale slot to reuse.
+static int life_seen(struct life *l)
+{
+	uint32_t h = (uint32_t)((l->grid * 0x9e3779b97f4a7c15ULL) >> 58);
+	uint32_t gen = l->generation + 1;	// 0 marks an empty slot
+	int i, slot = -1;
+
+	for (i = 0; i < LIFE_HASH_SIZE; i++, h = (h + 1) & (LIFE_HASH_SIZE - 1))
+	{
+		if (l->seen[h].generation != 0 && l->seen[h].state == l->grid)
+		{
+			if (gen - l->seen[h].generation <= LIFE_HISTORY)
+				return 1;
+			slot = h;
+			break;
+		}
+		if (slot < 0 && (l->seen[h].generation == 0 || gen - l->seen[h].generation > LIFE_HISTORY))
+			slot = h;
+		if (l->seen[h].generation == 0)
+			break;
+	}
+	l->seen[slot].state = l->grid;
+	l->seen[slot].generation = gen;
+	return 0;
+}
+
+int life_step(struct life *l, uint16_t switches)
+{
+	l->grid = life_next(l->grid, l->birth, l->survive, l->wrap);
+	l->generation++;
+	if (l->grid == 0 || life_seen(l))
+	{
+		// the next pattern, not the same one again; all down stays random
+		life_seed(l, switches ? switches + l->seeds : 0);
+		return 1;
+	}
+	return 0;
+}
+
+
+// PART 2 - benchmark --------------------------------------------------
+
+int life_bench(void)
+{
+	static struct life l;
+	static volatile uint64_t sink;		// keeps the generations from being optimised away
+	uint64_t g = 0x0123456789abcULL;
+	double start, next, step;
+	long n, gens = 0, steps = 0;
+	uint16_t birth, survive;
+
+	life_parse_rule("B3/S23", &birth, &survive);
+
+	// the bare generation, chained so every step depends on the last
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 100000; n++)
+			g = life_next(g ^ n, birth, survive, 1);
+		gens += n;
+	} while ((next = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+	sink = g;
+
+	// with cycle detection and reseeding
+	l.birth = birth;
+	l.survive = survive;
+	l.wrap = 1;
+	life_seed(&l, 05252);
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 100000; n++)
+			life_step(&l, 05252);
+		steps += n;
+	} while ((step = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+
+	printf("life: %dx%d grid in one 64 bit word, rule B3/S23 with wrapping\n", LIFE_COLS, LIFE_ROWS);
+	printf("life: next generation     %.1f generations/us (%.1f ns each)\n",
+	       gens / next / 1e6, 1e9 * next / gens);
+	printf("life: with cycle checks   %.1f generations/us, %u reseeds\n",
+	       steps / step / 1e6, l.seeds);
+	return 0;
+}
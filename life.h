@@ -0,0 +1,57 @@
+/*
+ * life.h: bit-parallel cellular automaton on the five 12 bit registers
+ *
+ * The PC, MA, MB, AC and MQ rows form a 12 x 5 grid that is kept in a
+ * single 64 bit word, 12 bits per row with row 0 (PC) in the low bits and
+ * column 0 (the rightmost LED) in bit 0 of its row.
+ */
+
+#ifndef LIFE_H
+#define LIFE_H
+
+#include <stdint.h>
+
+#define LIFE_ROWS	5
+#define LIFE_COLS	12
+#define LIFE_HISTORY	32	// generations searched for repeating states
+#define LIFE_HASH_SIZE	64	// slots of the recent state table (power of 2)
+
+struct life {
+	uint64_t grid;
+	uint16_t birth;			// bit n set: born with n neighbours
+	uint16_t survive;		// bit n set: survives with n neighbours
+	int      wrap;			// edges wrap around (torus)
+	uint32_t generation;
+	uint32_t seeds;			// times the grid was seeded
+	struct {
+		uint64_t state;
+		uint32_t generation;	// 0 = empty slot
+	} seen[LIFE_HASH_SIZE];
+};
+
+// Rules in B/S notation, e.g. "B3/S23".  Returns 0 on success.
+int life_parse_rule(const char *rule, uint16_t *birth, uint16_t *survive);
+
+// Rules offered on the IF switches 2..7 (1 is the configured rule)
+extern const char *const life_presets[6];
+
+// Start over from a pattern derived from the switch register
+void life_seed(struct life *l, uint16_t switches);
+
+// Compute the next generation of a grid
+uint64_t life_next(uint64_t grid, uint16_t birth, uint16_t survive, int wrap);
+
+// Advance one generation, reseeding when the grid dies out or repeats
+// itself within LIFE_HISTORY generations.  Returns 1 after a reseed.
+int life_step(struct life *l, uint16_t switches);
+
+// One register's worth of cells, bit 11 is the leftmost LED
+static inline uint16_t life_row(const struct life *l, int row)
+{
+	return (l->grid >> (row * LIFE_COLS)) & 07777;
+}
+
+// Benchmark generations per microsecond
+int life_bench(void);
+
+#endif
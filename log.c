@@ -0,0 +1,319 @@
+/*
+ * log.c: non-blocking logging
+ *
+ * The ring is a bounded multi-producer queue with a sequence number per
+ * slot (the audio, config, mirror, multiplexer and worker threads all
+ * log).  A producer claims a slot by advancing head with a compare and
+ * swap, formats into it and publishes it by setting its sequence number;
+ * the writer takes slots in order once they are published.  No producer
+ * ever takes a lock or waits for the writer; one that publishes while
+ * the writer sleeps posts a semaphore to wake it, which never blocks.
+ *
+ * The message text is formatted by the caller: the arguments may not
+ * outlive the call.  The writer adds the time and level.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "delay.h"
+
+#define WRITER_IDLE_NS	100000000	// look at the drop count this often when idle
+
+struct slot {
+	unsigned seq;			// == position + 1 once published
+	unsigned char level;
+	struct timespec when;
+	char text[LOG_TEXT];
+};
+
+static const char *const level_names[] = { "error", "warn", "info", "debug" };
+static const int syslog_prio[] = { LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG };
+
+static struct {
+	struct slot slot[LOG_SLOTS];
+	unsigned head;			// next position to claim
+	unsigned tail;			// next position to write, writer only
+	unsigned long dropped;
+	unsigned long reported;		// drops already written out, writer only
+	int level;
+	int running;
+	volatile int stop;
+	int sleeping;			// the writer waits on wake
+	sem_t wake;
+	FILE *out;			// NULL for syslog
+	pthread_t writer;
+} ring = { .level = LOG_LEVEL_INFO };
+
+
+// PART 1 - producers --------------------------------------------------
+
+static void write_direct(int level, const char *fmt, va_list ap)
+{
+	if (level <= LOG_LEVEL_WARN)
+		fprintf(stderr, "%s: ", level_names[level]);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+	struct slot *s;
+	unsigned pos, seq;
+	va_list ap;
+	int len;
+
+	if (level > ring.level)
+		return;
+	va_start(ap, fmt);
+	if (!ring.running)
+	{
+		write_direct(level, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+	for (;;)
+	{
+		s = &ring.slot[pos & (LOG_SLOTS - 1)];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if ((int)(seq - pos) < 0)
+		{
+			// the writer hasn't freed this slot yet: ring full
+			__atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+			va_end(ap);
+			return;
+		}
+		if (seq == pos &&
+		    __atomic_compare_exchange_n(&ring.head, &pos, pos + 1, 1,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+		if (seq != pos)
+			pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+	}
+
+	s->level = level;
+	clock_gettime(CLOCK_REALTIME, &s->when);
+	len = vsnprintf(s->text, LOG_TEXT, fmt, ap);
+	va_end(ap);
+	// drop a trailing newline, the writer adds its own
+	if (len > 0 && len < LOG_TEXT && s->text[len - 1] == '\n')
+		s->text[len - 1] = 0;
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+	if (__atomic_exchange_n(&ring.sleeping, 0, __ATOMIC_SEQ_CST))
+		sem_post(&ring.wake);
+}
+
+unsigned long log_dropped(void)
+{
+	return __atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+}
+
+
+// PART 2 - the writer -------------------------------------------------
+
+static void emit(int level, const struct timespec *when, const char *text)
+{
+	struct tm tm;
+
+	if (!ring.out)
+	{
+		syslog(syslog_prio[level], "%s", text);
+		return;
+	}
+	localtime_r(&when->tv_sec, &tm);
+	fprintf(ring.out, "%02d:%02d:%02d.%03ld %-5s %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+		when->tv_nsec / 1000000, level_names[level], text);
+}
+
+// Write every published slot, returns how many
+static int drain(void)
+{
+	struct timespec now;
+	struct slot *s;
+	unsigned long dropped;
+	char line[64];
+	int n = 0;
+
+	for (;;)
+	{
+		s = &ring.slot[ring.tail & (LOG_SLOTS - 1)];
+		if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != ring.tail + 1)
+			break;
+		emit(s->level, &s->when, s->text);
+		// free the slot for the producer that wraps around to it
+		__atomic_store_n(&s->seq, ring.tail + LOG_SLOTS, __ATOMIC_RELEASE);
+		ring.tail++;
+		n++;
+	}
+
+	dropped = log_dropped();
+	if (dropped != ring.reported)
+	{
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(line, sizeof line, "log: %lu messages dropped", dropped - ring.reported);
+		emit(LOG_LEVEL_WARN, &now, line);
+		ring.reported = dropped;
+		n++;
+	}
+	if (n && ring.out)
+		fflush(ring.out);
+	return n;
+}
+
+static void *writer(void *arg)
+{
+	struct timespec ts;
+
+	(void)arg;
+	while (!ring.stop)
+	{
+		if (drain())
+			continue;
+		// sleep until a producer posts, checking once more after
+		// announcing it so a message published just before isn't missed
+		__atomic_store_n(&ring.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (drain())
+		{
+			__atomic_store_n(&ring.sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += WRITER_IDLE_NS;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		sem_timedwait(&ring.wake, &ts);
+	}
+	drain();
+	return NULL;
+}
+
+static int start_writer(FILE *out, int level)
+{
+	unsigned i;
+
+	for (i = 0; i < LOG_SLOTS; i++)
+		ring.slot[i].seq = i;
+	ring.head = ring.tail = 0;
+	ring.dropped = ring.reported = 0;
+	ring.out = out;
+	ring.level = level;
+	ring.stop = 0;
+	ring.sleeping = 0;
+	sem_init(&ring.wake, 0, 0);
+	if (pthread_create(&ring.writer, NULL, writer, NULL))
+		return -1;
+	ring.running = 1;
+	return 0;
+}
+
+int log_start(const char *sink, int level)
+{
+	FILE *out = stdout;
+
+	if (sink && strcmp(sink, "syslog") == 0)
+	{
+		openlog("deeper", LOG_PID, LOG_DAEMON);
+		out = NULL;
+	}
+	else if (sink && strcmp(sink, "-") != 0 && (out = fopen(sink, "a")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", sink, strerror(errno));
+		return -1;
+	}
+	return start_writer(out, level);
+}
+
+void log_stop(void)
+{
+	if (!ring.running)
+		return;
+	ring.stop = 1;
+	pthread_join(ring.writer, NULL);
+	ring.running = 0;
+	if (ring.out && ring.out != stdout)
+		fclose(ring.out);
+	else if (!ring.out)
+		closelog();
+}
+
+
+// PART 3 - benchmark --------------------------------------------------
+
+// Log n messages, returns the mean ns per call, worst in *worst
+static double push(int n, uint64_t *worst)
+{
+	uint64_t start, t, total = 0;
+	int i;
+
+	*worst = 0;
+	for (i = 0; i < n; i++)
+	{
+		start = delay_now();
+		log_info("Register Switch: Value=%lu  delay=%lu  varietyMult=%lu", (unsigned long)i, 50000ul, 0ul);
+		t = delay_now() - start;
+		total += t;
+		if (t > *worst)
+			*worst = t;
+		if (i % 64 == 63)
+			usleep(100);	// a burst, then let the writer catch up
+	}
+	return (double)total / n;
+}
+
+int log_bench(void)
+{
+	char buf[65536];
+	uint64_t worst;
+	double mean;
+	int fd[2], flags;
+	FILE *null, *out;
+
+	// a sink that keeps up
+	if ((null = fopen("/dev/null", "w")) == NULL || start_writer(null, LOG_LEVEL_INFO))
+		return -1;
+	mean = push(100000, &worst);
+	log_stop();			// closes null
+	printf("log: to /dev/null  %.0f ns per message, worst %.1f us, %lu dropped\n",
+	       mean, worst / 1000.0, log_dropped());
+
+	// a console that has stopped reading: the writer blocks on the full
+	// pipe, the ring fills up, and messages are dropped instead of waited for
+	if (pipe(fd) || (out = fdopen(fd[1], "w")) == NULL || start_writer(out, LOG_LEVEL_INFO))
+		return -1;
+	mean = push(100000, &worst);
+	printf("log: stalled pipe  %.0f ns per message, worst %.1f us, %lu dropped\n",
+	       mean, worst / 1000.0, log_dropped());
+
+	// unblock the writer so it can finish
+	flags = fcntl(fd[0], F_GETFL);
+	fcntl(fd[0], F_SETFL, flags | O_NONBLOCK);
+	ring.stop = 1;
+	for (;;)
+	{
+		while (read(fd[0], buf, sizeof buf) > 0)
+			;
+		if (pthread_tryjoin_np(ring.writer, NULL) == 0)
+			break;
+		usleep(1000);
+	}
+	ring.running = 0;
+	fclose(out);
+	close(fd[0]);
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * log.h: non-blocking logging
+ *
+ * log_write() formats the message into a slot of a lock-free ring and
+ * returns; a background thread adds the time and level and writes it to
+ * stdout, a file or syslog.  When the sink falls behind and the ring is
+ * full, messages are dropped and counted, never waited for.  Before
+ * log_start() (and in the benchmarks) messages go straight to stderr.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+enum log_level {
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG
+};
+
+#define LOG_TEXT	112	// longest message, longer ones are cut
+#define LOG_SLOTS	256	// messages in flight, a power of 2
+
+// Start the writer: sink is NULL or "-" for stdout, "syslog", or a file
+// to append to.  Messages above level are discarded.  0 on success.
+int log_start(const char *sink, int level);
+
+// Write out what is queued and stop the writer
+void log_stop(void);
+
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_error(...)	log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)	log_write(LOG_LEVEL_WARN,  __VA_ARGS__)
+#define log_info(...)	log_write(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define log_debug(...)	log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Messages dropped because the ring was full
+unsigned long log_dropped(void);
+
+// Cost of a log_write, and what a stalled sink does to it
+int log_bench(void);
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * mirror.c: panel mirroring over UDP
+ *
+ * The mode logic calls mirror_publish() when a frame is complete; it
+ * copies the rows under a short lock and wakes the sender thread, so only
+ * whole frames are sent and neither the mode logic nor the blink() thread
+ * waits for the network.  The switches are also polled every
+ * MIRROR_POLL_US, since frames can be seconds apart in the slow modes.
+ * A datagram goes out whenever a row changed, and a keyframe at least
+ * every MIRROR_KEY_US even when nothing did, so a receiver that starts
+ * late or loses packets catches up within a second.
+*/
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mirror.h"
+#include "delay.h"
+#include "log.h"
+
+#define MIRROR_KEY_US		1000000		// keyframe at least once a second
+#define MIRROR_POLL_US		20000		// switches, between frames
+
+static struct {
+	int  sock;
+	int  panel;
+	const volatile uint32_t *leds;
+	const volatile uint32_t *switches;
+	volatile int running;
+	pthread_mutex_t lock;			// pending and changed
+	uint16_t pending[MIRROR_ROWS];		// the last frame published
+	int  changed;				// the sender hasn't taken it yet
+	sem_t wake;
+	pthread_t thread;
+} mirror = { .sock = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+
+// PART 1 - packet format ----------------------------------------------
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+	return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+int mirror_encode(uint8_t *buf, const struct mirror_frame *f, const uint16_t *key, uint32_t key_seq)
+{
+	uint16_t x[MIRROR_ROWS];
+	uint8_t *p = buf + MIRROR_HEADER;
+	int i, n, last;
+
+	if (key == NULL)
+		for (i = 0; i < MIRROR_ROWS; i++)
+			p = put16(p, f->rows[i]);
+	else
+	{
+		last = 0;			// rows after the last change are implied
+		for (i = 0; i < MIRROR_ROWS; i++)
+			if ((x[i] = f->rows[i] ^ key[i]) != 0)
+				last = i + 1;
+		for (i = 0; i < last; )
+		{
+			for (n = 0; i + n < last && x[i + n] == 0 && n < 127; n++)
+				;
+			if (n)
+			{
+				*p++ = n;
+				i += n;
+				continue;
+			}
+			for (n = 0; i + n < last && x[i + n] != 0 && n < 127; n++)
+				;
+			*p++ = 0x80 | n;
+			for (; n > 0; n--, i++)
+				p = put16(p, x[i]);
+		}
+	}
+
+	buf[0] = 'D';
+	buf[1] = '8';
+	buf[2] = MIRROR_VERSION;
+	buf[3] = key ? MIRROR_DELTA : MIRROR_KEYFRAME;
+	put16(buf + 4, f->panel);
+	put16(buf + 6, p - buf);
+	put32(buf + 8, f->seq);
+	put32(buf + 12, key ? key_seq : f->seq);
+	put32(buf + 16, f->usec);
+	put32(buf + 20, f->session);
+	return p - buf;
+}
+
+int mirror_decode(struct mirror_decoder *d, const uint8_t *buf, int len, struct mirror_frame *out)
+{
+	const uint8_t *p = buf + MIRROR_HEADER;
+	const uint8_t *end = buf + len;
+	uint32_t seq, key_seq, session;
+	int i, n;
+
+	if (len < MIRROR_HEADER || buf[0] != 'D' || buf[1] != '8' ||
+	    buf[2] != MIRROR_VERSION || get16(buf + 6) != len)
+		return -1;
+	out->type = buf[3];
+	out->panel = get16(buf + 4);
+	seq = out->seq = get32(buf + 8);
+	key_seq = get32(buf + 12);
+	out->usec = get32(buf + 16);
+	session = out->session = get32(buf + 20);
+
+	// the sender restarted: its sequence numbers start over
+	if (d->have_seq && session != d->session)
+	{
+		d->have_seq = 0;
+		d->have_key = 0;
+		d->restarts++;
+	}
+	d->session = session;
+
+	// late or duplicate
+	if (d->have_seq && (int32_t)(seq - d->last_seq) <= 0)
+	{
+		d->dropped++;
+		return 1;
+	}
+
+	if (out->type == MIRROR_KEYFRAME)
+	{
+		if (len != MIRROR_HEADER + MIRROR_ROWS * 2)
+			return -1;
+		for (i = 0; i < MIRROR_ROWS; i++, p += 2)
+			out->rows[i] = get16(p);
+	}
+	else if (out->type == MIRROR_DELTA)
+	{
+		if (!d->have_key || key_seq != d->key_seq)
+		{
+			// it arrived, so it's no gap, but can't be rebuilt:
+			// wait for the next keyframe
+			if (d->have_seq)
+				d->lost += seq - d->last_seq - 1;
+			d->last_seq = seq;
+			d->have_seq = 1;
+			d->dropped++;
+			return 1;
+		}
+		memcpy(out->rows, d->key, sizeof out->rows);
+		for (i = 0; p < end; )
+		{
+			n = *p & 0x7f;
+			if (n == 0 || i + n > MIRROR_ROWS)
+				return -1;
+			if (*p++ & 0x80)
+			{
+				if (p + 2 * n > end)
+					return -1;
+				for (; n > 0; n--, i++, p += 2)
+					out->rows[i] ^= get16(p);
+			}
+			else
+				i += n;
+		}
+	}
+	else
+		return -1;
+
+	if (out->type == MIRROR_KEYFRAME)
+	{
+		memcpy(d->key, out->rows, sizeof d->key);
+		d->key_seq = seq;
+		d->have_key = 1;
+	}
+	if (d->have_seq)
+		d->lost += seq - d->last_seq - 1;
+	d->last_seq = seq;
+	d->have_seq = 1;
+	d->frames++;
+	return 0;
+}
+
+
+// PART 2 - sender -----------------------------------------------------
+
+void mirror_publish(const volatile uint32_t *leds)
+{
+	uint16_t rows[MIRROR_ROWS];
+	int i, post;
+
+	if (!mirror.running || leds != mirror.leds)
+		return;
+	for (i = 0; i < MIRROR_LED_ROWS; i++)
+		rows[i] = leds[i];
+	for (i = 0; i < MIRROR_ROWS - MIRROR_LED_ROWS; i++)
+		rows[MIRROR_LED_ROWS + i] = mirror.switches[i];
+
+	pthread_mutex_lock(&mirror.lock);
+	post = !mirror.changed && memcmp(rows, mirror.pending, sizeof rows) != 0;
+	if (post || mirror.changed)
+	{
+		memcpy(mirror.pending, rows, sizeof rows);
+		mirror.changed = 1;
+	}
+	pthread_mutex_unlock(&mirror.lock);
+	if (post)
+		sem_post(&mirror.wake);
+}
+
+static void *mirror_thread(void *arg)
+{
+	struct mirror_frame f;
+	uint16_t key[MIRROR_ROWS];
+	uint16_t last[MIRROR_ROWS];
+	uint8_t buf[MIRROR_MAX_PACKET];
+	uint32_t key_seq = 0;
+	uint64_t now, key_time = 0;
+	struct timespec ts;
+	int len, i;
+
+	(void)arg;
+	memset(&f, 0, sizeof f);
+	f.panel = mirror.panel;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	f.session = ts.tv_nsec ^ ts.tv_sec << 20 ^ getpid();
+
+	for (;;)
+	{
+		// the LED rows of the last frame, the switches as they are now
+		pthread_mutex_lock(&mirror.lock);
+		for (i = 0; i < MIRROR_ROWS - MIRROR_LED_ROWS; i++)
+			mirror.pending[MIRROR_LED_ROWS + i] = mirror.switches[i];
+		memcpy(f.rows, mirror.pending, sizeof f.rows);
+		mirror.changed = 0;
+		pthread_mutex_unlock(&mirror.lock);
+		now = delay_now() / 1000;
+		if (f.seq == 0 || now - key_time >= MIRROR_KEY_US)
+		{
+			f.seq++;
+			f.usec = now;
+			len = mirror_encode(buf, &f, NULL, 0);
+			memcpy(key, f.rows, sizeof key);
+			key_seq = f.seq;
+			key_time = now;
+			send(mirror.sock, buf, len, 0);
+		}
+		else if (memcmp(f.rows, last, sizeof last) != 0)
+		{
+			f.seq++;
+			f.usec = now;
+			len = mirror_encode(buf, &f, key, key_seq);
+			send(mirror.sock, buf, len, 0);
+		}
+		memcpy(last, f.rows, sizeof last);
+
+		// until the next frame is published or the switches are due
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += MIRROR_POLL_US * 1000L;
+		if (ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait(&mirror.wake, &ts);
+	}
+	return NULL;
+}
+
+// Connected UDP socket to host[:port]
+static int mirror_connect(const char *dest)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256], port[16];
+	const char *colon = strrchr(dest, ':');
+	int sock = -1, err;
+
+	if (colon && colon - dest < (int)sizeof host)
+	{
+		snprintf(host, sizeof host, "%.*s", (int)(colon - dest), dest);
+		snprintf(port, sizeof port, "%s", colon + 1);
+	}
+	else
+	{
+		snprintf(host, sizeof host, "%s", dest);
+		snprintf(port, sizeof port, "%d", MIRROR_DEFAULT_PORT);
+	}
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_INET;	// deeper-rx listens on IPv4 only
+	hints.ai_socktype = SOCK_DGRAM;
+	if ((err = getaddrinfo(host, port, &hints, &res)) != 0)
+	{
+		log_error("mirror: %s: %s", dest, gai_strerror(err));
+		return -1;
+	}
+	for (ai = res; ai; ai = ai->ai_next)
+	{
+		if ((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(res);
+	if (sock < 0)
+		log_error("mirror: can't reach %s", dest);
+	return sock;
+}
+
+int mirror_start(const char *dest, int panel,
+		 const volatile uint32_t *leds, const volatile uint32_t *switches)
+{
+	if ((mirror.sock = mirror_connect(dest)) < 0)
+		return -1;
+	mirror.panel = panel;
+	mirror.leds = leds;
+	mirror.switches = switches;
+	sem_init(&mirror.wake, 0, 0);
+	if (pthread_create(&mirror.thread, NULL, mirror_thread, NULL))
+	{
+		close(mirror.sock);
+		mirror.sock = -1;
+		return -1;
+	}
+	pthread_detach(mirror.thread);
+	mirror.running = 1;
+	return 0;
+}
+
+
+// PART 3 - benchmark --------------------------------------------------
+
+// Frames change like the normal mode: new data registers now and then,
+// operation LEDs every frame, switches hardly ever
+static void bench_frame(struct mirror_frame *f, int n)
+{
+	int i;
+
+	if (n % 10 == 0)
+		for (i = 0; i < 5; i++)
+			f->rows[i] = rand() & 07777;
+	f->rows[5] = (f->rows[5] & 017) | (rand() & 07760);
+	if (n % 500 == 0)
+		f->rows[MIRROR_LED_ROWS] = rand() & 07777;
+}
+
+int mirror_bench(void)
+{
+	enum { FRAMES = 200000, KEY_EVERY = 200 };	// keyframe once a second at 200Hz
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof addr;
+	struct mirror_frame f, out;
+	struct mirror_decoder dec;
+	uint16_t key[MIRROR_ROWS];
+	uint8_t buf[MIRROR_MAX_PACKET];
+	uint32_t key_seq = 0;
+	double encode = 0, decode = 0, t;
+	long bytes = 0, keys = 0, errors = 0;
+	int tx, rx, len, n;
+
+	rx = socket(AF_INET, SOCK_DGRAM, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr *)&addr, sizeof addr) ||
+	    getsockname(rx, (struct sockaddr *)&addr, &alen) ||
+	    connect(tx, (struct sockaddr *)&addr, sizeof addr))
+	{
+		perror("mirror");
+		return -1;
+	}
+
+	memset(&f, 0, sizeof f);
+	memset(&dec, 0, sizeof dec);
+	for (n = 0; n < FRAMES; n++)
+	{
+		bench_frame(&f, n);
+		f.seq++;
+
+		// sender: encode and send
+		t = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+		if (n % KEY_EVERY == 0)
+		{
+			len = mirror_encode(buf, &f, NULL, 0);
+			memcpy(key, f.rows, sizeof key);
+			key_seq = f.seq;
+			keys++;
+		}
+		else
+			len = mirror_encode(buf, &f, key, key_seq);
+		send(tx, buf, len, 0);
+		encode += delay_sec(CLOCK_THREAD_CPUTIME_ID) - t;
+		bytes += len;
+
+		// receiver: receive and rebuild
+		t = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+		len = recv(rx, buf, sizeof buf, 0);
+		if (mirror_decode(&dec, buf, len, &out) != 0 ||
+		    memcmp(out.rows, f.rows, sizeof f.rows) != 0)
+			errors++;
+		decode += delay_sec(CLOCK_THREAD_CPUTIME_ID) - t;
+	}
+	close(tx);
+	close(rx);
+
+	printf("mirror: %d frames over loopback, keyframe every %d\n", FRAMES, KEY_EVERY);
+	printf("mirror: %.1f bytes/frame on average (keyframe %d, header %d)\n",
+	       (double)bytes / FRAMES, MIRROR_HEADER + MIRROR_ROWS * 2, MIRROR_HEADER);
+	printf("mirror: %.0f bytes/s at 200 frames/s\n", 200.0 * bytes / FRAMES);
+	printf("mirror: sender   %.2f us cpu/frame (encode + send)\n", 1e6 * encode / FRAMES);
+	printf("mirror: receiver %.2f us cpu/frame (receive + decode)\n", 1e6 * decode / FRAMES);
+	printf("mirror: %ld keyframes, %ld frames not rebuilt exactly\n", keys, errors);
+	return errors ? -1 : 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * mirror.h: panel mirroring over UDP
+ *
+ * The mode logic publishes every finished frame of a panel and a sender
+ * thread sends each change as a datagram.  Keyframes carry all rows; the frames in
+ * between carry the rows XORed with the last keyframe, run-length coded,
+ * so any frame can be rebuilt from its keyframe alone and a lost packet
+ * never corrupts the frames after it.
+ *
+ * Packet: 24 byte header, all fields big endian
+ *	'D' '8' version type panel(16) length(16) seq(32) key_seq(32) usec(32)
+ *	session(32)
+ * The session is picked at random when the sender starts; a receiver
+ * that sees it change starts over instead of taking the restarted
+ * sender's low sequence numbers for late packets.
+ * Keyframe payload: MIRROR_ROWS 16 bit rows
+ * Delta payload: tokens, 0x01-0x7f = that many unchanged rows,
+ *	0x81-0xff = that many XORed 16 bit rows follow; missing rows are unchanged
+ */
+
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <stdint.h>
+
+#define MIRROR_DEFAULT_PORT	8008
+#define MIRROR_VERSION		2
+#define MIRROR_HEADER		24
+#define MIRROR_LED_ROWS		8
+#define MIRROR_ROWS		(MIRROR_LED_ROWS + 3)	// 8 LED rows, 3 switch rows
+#define MIRROR_MAX_PACKET	(MIRROR_HEADER + MIRROR_ROWS * 3)
+
+#define MIRROR_KEYFRAME		0
+#define MIRROR_DELTA		1
+
+struct mirror_frame {
+	uint16_t panel;
+	uint8_t  type;
+	uint32_t seq;
+	uint32_t usec;			// sender's monotonic clock, low 32 bits
+	uint32_t session;		// changes when the sender restarts
+	uint16_t rows[MIRROR_ROWS];
+};
+
+// Receiver side state, one per panel
+struct mirror_decoder {
+	uint32_t session;
+	int      have_seq;		// last_seq is valid
+	int      have_key;
+	uint32_t key_seq;
+	uint16_t key[MIRROR_ROWS];
+	uint32_t last_seq;
+	uint32_t frames;		// decoded
+	uint32_t lost;			// never arrived: gaps in the sequence numbers
+	uint32_t dropped;		// late, duplicate or without their keyframe
+	uint32_t restarts;		// sessions after the first
+};
+
+// Build a packet, a delta if key is not NULL.  Returns its length.
+int mirror_encode(uint8_t *buf, const struct mirror_frame *f, const uint16_t *key, uint32_t key_seq);
+
+// Rebuild a frame from a packet.  Returns 0 with a new frame in out,
+// 1 if the packet was dropped, -1 if it is not a valid packet.
+int mirror_decode(struct mirror_decoder *d, const uint8_t *buf, int len, struct mirror_frame *out);
+
+// Start sending the rows of a panel to host[:port]. Returns 0 on success.
+int mirror_start(const char *dest, int panel,
+		 const volatile uint32_t *leds, const volatile uint32_t *switches);
+
+// A frame of the panel with these LED rows is complete: send it if it
+// changed.  Never waits for the network; other panels are ignored.
+void mirror_publish(const volatile uint32_t *leds);
+
+// Measure bandwidth and CPU per frame over loopback
+int mirror_bench(void);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * mirror_rx.c: receive and print the frames of mirrored panels
+ *
+ * Usage: deeper-rx [-p port]
+ *
+ * Prints one line per rebuilt frame: sequence number, sender time in ms,
+ * K for keyframes or D for deltas, the panel, the 8 LED rows and the
+ * 3 switch rows in octal.  Redirect it to a file to record a session.
+ * CTRL-C prints frame, loss and drop counts per panel.
+ *
+ * A panel is its sender's IP address plus the panel number in the
+ * header, so several machines that all send panel 0 don't share (and
+ * confuse) one decoder, while a restarted sender (new source port, new
+ * session) keeps its entry.  The panel column is the index in that
+ * table.  When it is full, the entry heard from least recently is reused
+ * if it has been quiet for SOURCE_IDLE seconds.
+*/
+
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mirror.h"
+
+#define MAX_PANELS	16
+#define SOURCE_IDLE	10	// s without a packet before an entry may be reused
+
+struct source {
+	struct in_addr from;
+	uint16_t panel;
+	time_t   heard;
+	struct mirror_decoder dec;
+};
+
+static struct source sources[MAX_PANELS];
+static int nsources;
+
+static volatile sig_atomic_t terminate = 0;
+
+static void sig_handler(int signo)
+{
+	(void)signo;
+	terminate = 1;
+}
+
+static void report(const struct source *s)
+{
+	fprintf(stderr, "panel %d (%s panel %u): %u frames, %u lost, %u dropped, %u restarts\n",
+		(int)(s - sources), inet_ntoa(s->from), s->panel,
+		s->dec.frames, s->dec.lost, s->dec.dropped, s->dec.restarts);
+}
+
+// The decoder for a sender and panel: a new one if there is room, else
+// the one quiet for longest if it is idle
+static struct source *find_source(struct in_addr from, uint16_t panel, time_t now)
+{
+	struct source *s, *oldest = NULL;
+	int i;
+
+	for (i = 0; i < nsources; i++)
+	{
+		s = &sources[i];
+		if (s->panel == panel && s->from.s_addr == from.s_addr)
+		{
+			s->heard = now;
+			return s;
+		}
+		if (!oldest || s->heard < oldest->heard)
+			oldest = s;
+	}
+	if (nsources < MAX_PANELS)
+		s = &sources[nsources++];
+	else if (now - oldest->heard >= SOURCE_IDLE)
+	{
+		s = oldest;
+		report(s);
+	}
+	else
+		return NULL;
+	memset(s, 0, sizeof *s);
+	s->from = from;
+	s->panel = panel;
+	s->heard = now;
+	return s;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct sockaddr_in addr, from;
+	socklen_t flen;
+	struct source *s;
+	struct mirror_frame f;
+	uint8_t buf[MIRROR_MAX_PACKET + 1];
+	int port = MIRROR_DEFAULT_PORT;
+	int sock, len, i, opt;
+
+	while ((opt = getopt(argc, argv, "p:")) != -1)
+	{
+		if (opt != 'p')
+		{
+			fprintf(stderr, "Usage: %s [-p port]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		port = atoi(optarg);
+	}
+
+	// no SA_RESTART, so CTRL-C interrupts recv()
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = sig_handler;
+	sigaction(SIGINT, &sa, NULL);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+	    bind(sock, (struct sockaddr *)&addr, sizeof addr) < 0)
+	{
+		perror("deeper-rx");
+		exit(EXIT_FAILURE);
+	}
+
+	while (!terminate)
+	{
+		flen = sizeof from;
+		if ((len = recvfrom(sock, buf, sizeof buf, 0, (struct sockaddr *)&from, &flen)) < MIRROR_HEADER)
+			continue;
+		if ((s = find_source(from.sin_addr, buf[4] << 8 | buf[5], time(NULL))) == NULL ||
+		    mirror_decode(&s->dec, buf, len, &f) != 0)
+			continue;
+		printf("%10u %10u %c %2d  %04o %04o %04o %04o %04o %04o %04o %04o  %04o %04o %04o\n",
+		       f.seq, f.usec / 1000, f.type == MIRROR_KEYFRAME ? 'K' : 'D', (int)(s - sources),
+		       f.rows[0], f.rows[1], f.rows[2], f.rows[3], f.rows[4], f.rows[5],
+		       f.rows[6], f.rows[7], f.rows[8], f.rows[9], f.rows[10]);
+	}
+
+	fflush(stdout);
+	for (i = 0; i < nsources; i++)
+		report(&sources[i]);
+	close(sock);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * panel.c: the worker pool that runs the mode logic of every panel
+ *
+ * Each panel is due at some time.  A worker takes the panel that is due
+ * first, runs one step of it outside the lock and puts it back with the
+ * due time the step returned.  A panel is only ever stepped by one worker
+ * at a time, so its mode state needs no locking.  With a handful of panels
+ * a linear scan is cheaper than any queue.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "delay.h"
+#include "log.h"
+#include "panel.h"
+
+struct pool {
+	struct panel **panels;
+	int      npanels;
+	long   (*step)(struct panel *p);
+	volatile int *terminate;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;		// a panel got a new due time
+};
+
+static void *worker(void *arg)
+{
+	struct pool *pool = arg;
+	struct panel *p;
+	struct timespec ts;
+	uint64_t now;
+	long us;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!*pool->terminate)
+	{
+		p = NULL;
+		for (i = 0; i < pool->npanels; i++)
+			if (!pool->panels[i]->busy && (!p || pool->panels[i]->due < p->due))
+				p = pool->panels[i];
+		if (!p)
+		{
+			// every panel is being stepped by another worker
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		now = delay_now();
+		if (p->due > now)
+		{
+			// sleep until it is due or another panel gets an earlier time
+			ts.tv_sec = p->due / 1000000000ull;
+			ts.tv_nsec = p->due % 1000000000ull;
+			pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+			continue;
+		}
+
+		p->busy = 1;
+		pthread_mutex_unlock(&pool->lock);
+		us = pool->step(p);
+		pthread_mutex_lock(&pool->lock);
+		p->due = delay_now() + (uint64_t)(us > 0 ? us : 0) * 1000;
+		p->busy = 0;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void pool_run(struct panel **panels, int npanels, int workers,
+	      long (*step)(struct panel *p), volatile int *terminate)
+{
+	struct pool pool;
+	pthread_condattr_t attr;
+	pthread_t *threads;
+	int i, started;
+
+	pool.panels = panels;
+	pool.npanels = npanels;
+	pool.step = step;
+	pool.terminate = terminate;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (i = 0; i < npanels; i++)
+	{
+		panels[i]->due = 0;
+		panels[i]->busy = 0;
+	}
+
+	// the calling thread is worker 0
+	threads = calloc(workers > 1 ? workers - 1 : 1, sizeof *threads);
+	for (started = 0; threads && started < workers - 1; started++)
+		if (pthread_create(&threads[started], NULL, worker, &pool))
+		{
+			log_warn("pool: only %d of %d workers started", started + 1, workers);
+			break;
+		}
+	worker(&pool);
+
+	// wake workers waiting for a busy panel so they see *terminate
+	pthread_mutex_lock(&pool.lock);
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,130 @@
+/*
+ * panel.h: per-panel state, panel backends, the multiplexer and the
+ * worker pool that runs the mode logic
+ *
+ * Everything a front panel needs lives in its struct panel: the LED and
+ * switch rows shared with the multiplexer, the backend that drives the
+ * hardware and the state of the mode logic.  One multiplexer thread
+ * (blink) refreshes any number of panels, lighting the same row of every
+ * panel in the same time slot.  The mode logic of all panels runs on a
+ * small pool of worker threads.
+ *
+ * While every LED of every panel is off the multiplexer parks: it only
+ * reads the switches, MULTIPLEX_POLL_HZ times a second, and otherwise
+ * sleeps on a futex that multiplex_wake() posts when a frame with LEDs
+ * on is published.
+ */
+
+#ifndef PANEL_H
+#define PANEL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "compose.h"
+#include "config.h"
+#include "life.h"
+#include "sysload.h"
+
+struct panel;
+struct multiplex;
+
+// How the multiplexer talks to a panel.  All calls come from the
+// multiplexer thread; open() is called once before the first refresh.
+struct panel_backend {
+	const char *name;
+	int      (*open)(struct panel *p);
+	void     (*close)(struct panel *p);
+	void     (*leds_begin)(struct panel *p);		// columns to outputs
+	void     (*row_on)(struct panel *p, int row, uint32_t leds);
+	void     (*row_off)(struct panel *p, int row);
+	void     (*switches_begin)(struct panel *p);		// columns to inputs
+	void     (*switch_row_on)(struct panel *p, int row);
+	uint32_t (*switch_row_read)(struct panel *p, int row);	// read and release
+};
+
+extern const struct panel_backend gpio_backend;		// gpio.c, the real PiDP-8
+extern const struct panel_backend sim_backend;		// sim.c, no hardware
+
+struct panel {
+	int      id;
+	int      quiet;				// no console output
+	const struct panel_backend *backend;
+	void    *io;				// backend state
+	struct multiplex *mux;			// set by blink(), for multiplex_wake()
+
+	volatile uint32_t ledstatus[8];		// bitfields: 8 ledrows of up to 12 LEDs
+	volatile uint32_t switchstatus[3];	// bitfields: 3 rows of up to 12 switches
+
+	// worker pool bookkeeping
+	uint64_t due;				// ns, CLOCK_MONOTONIC
+	int      busy;
+
+	// mode logic, see deeper_step()
+	int      started;
+	int      phase;
+	const struct config *cfg;		// held from a frame's start to its end
+	uint32_t cfgGeneration;			// of the table the layers were drawn with
+	struct compositor comp;
+	time_t   clockShown;
+	int      statusShown;
+	int      deeperThoughMode;
+	int      swIfValue;
+	int      modeKind;
+	int      lastKind;
+	int      dontChangeLEDs;
+	int      audioActive;
+	unsigned long sleepTime;
+	unsigned long opledDelay;		// operation LEDs dark this cycle, us
+	unsigned long delayAmount;
+	unsigned long varietyMult;
+	unsigned long swRegValue;
+	unsigned long swStepValue;
+	unsigned long stopPressedTime;
+	unsigned long startPressedTime;
+	int      x, y, shift_dir;		// snake
+	struct life life;
+	struct sysload load;
+};
+
+#define MULTIPLEX_POLL_HZ	50	// switch reads per second while parked
+
+// Multiplexer: refreshes panels until *terminate is set
+struct multiplex {
+	struct panel **panels;
+	int      npanels;
+	volatile int *terminate;
+
+	// parking while dark
+	uint32_t wake;				// futex, counts multiplex_wake() calls that woke
+	int      parked;			// sleeping on wake
+	volatile uint64_t parks;		// times the panels went dark
+
+	// statistics of the refresh period (LED rows plus switch scan)
+	volatile uint64_t frames;
+	uint64_t period_sum;			// ns
+	double   period_sumsq;
+	uint64_t period_min;
+	uint64_t period_max;
+};
+
+void *blink(void *mux);				// gpio.c, the real-time multiplexing thread
+
+// A panel published LEDs: resume refreshing if parked and any of them is
+// on.  Any thread, never blocks; p->mux may be NULL before blink() started.
+void multiplex_wake(struct panel *p);
+
+// Run step() for every panel when it is due, on the calling thread plus
+// workers - 1 more, until *terminate is set.  step() returns the number
+// of microseconds until the panel's next step.
+void pool_run(struct panel **panels, int npanels, int workers,
+	      long (*step)(struct panel *p), volatile int *terminate);
+
+// Demonstrate 1 to 16 simulated panels: CPU use and refresh stability
+int sim_bench(long (*step)(struct panel *p));
+
+// How long a parked multiplexer takes to light a simulated panel again,
+// and what it costs while parked with step() running the dark mode
+int park_bench(long (*step)(struct panel *p));
+
+#endif
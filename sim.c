@@ -0,0 +1,419 @@
+/*
+ * sim.c: simulated panels, for running without PiDP-8 hardware
+ *
+ * The sim backend drives a few fake registers the way the GPIO backend
+ * drives the real pins and reads its switches from memory, so the
+ * multiplexer does the same work per panel minus the bus cycles.
+ *
+ * "deeper -b panels" runs 1 to 16 simulated panels in a mix of modes for
+ * a few seconds each and reports CPU use and how steady the refresh is.
+ * "deeper -b park" runs the dark mode on a simulated panel, checks that
+ * its frames never wake the parked multiplexer, and measures how long
+ * the multiplexer takes to light the panel again and to see a switch.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "delay.h"
+#include "panel.h"
+
+#define SIM_SECONDS	3
+#define SIM_MAX_PANELS	16
+#define SIM_WAKES	200
+
+struct sim_io {
+	volatile uint32_t cols;		// column outputs, 1 = LED on
+	volatile int      row;		// lit LED row + 1, or switch row + 1
+	uint32_t switches[3];		// raw switch rows, 1 = up
+	uint64_t lit[8];		// times each LED row was lit
+	volatile uint64_t lit_at;	// ns of the first row lit with LEDs on, 0 = not yet
+	volatile uint64_t scans;	// switch scans
+};
+
+
+// PART 1 - the sim backend --------------------------------------------
+
+static int sim_open(struct panel *p)
+{
+	struct sim_io *io = p->io;
+
+	io->cols = 0;
+	io->row = 0;
+	memset(io->lit, 0, sizeof io->lit);
+	return 0;
+}
+
+static void sim_close(struct panel *p)
+{
+	(void)p;
+}
+
+static void sim_leds_begin(struct panel *p)
+{
+	(void)p;
+}
+
+static void sim_row_on(struct panel *p, int row, uint32_t leds)
+{
+	struct sim_io *io = p->io;
+	int k;
+
+	// one register write per column, like the GPIO backend
+	for (k = 0; k < 12; k++)
+		if (leds & (1 << k))
+			io->cols |= 1 << k;
+		else
+			io->cols &= ~(1 << k);
+	io->row = row + 1;
+	io->lit[row]++;
+	if (leds && !io->lit_at)
+		io->lit_at = delay_now();
+}
+
+static void sim_row_off(struct panel *p, int row)
+{
+	struct sim_io *io = p->io;
+
+	(void)row;
+	io->row = 0;
+}
+
+static void sim_switches_begin(struct panel *p)
+{
+	struct sim_io *io = p->io;
+
+	io->cols = 0;
+	io->scans++;
+}
+
+static void sim_switch_row_on(struct panel *p, int row)
+{
+	struct sim_io *io = p->io;
+
+	io->row = row + 1;
+}
+
+static uint32_t sim_switch_row_read(struct panel *p, int row)
+{
+	struct sim_io *io = p->io;
+
+	io->row = 0;
+	return io->switches[row];
+}
+
+const struct panel_backend sim_backend = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.leds_begin = sim_leds_begin,
+	.row_on = sim_row_on,
+	.row_off = sim_row_off,
+	.switches_begin = sim_switches_begin,
+	.switch_row_on = sim_switch_row_on,
+	.switch_row_read = sim_switch_row_read,
+};
+
+
+// PART 2 - multi-panel demo -------------------------------------------
+
+// DF and IF switches of the demo panels: normal, snake, dim, clock, life,
+// system load at 50Hz, test, sleep, then round again
+static const int sim_modes[8] = { 070, 010, 050, 060, 021, 047, 000, 030 };
+
+static long (*sim_step)(struct panel *p);
+static volatile long sim_steps;
+static volatile int sim_stop;
+
+static long count_step(struct panel *p)
+{
+	__sync_fetch_and_add(&sim_steps, 1);
+	return sim_step(p);
+}
+
+struct sim_run {
+	struct panel **panels;
+	int npanels;
+	int workers;
+	volatile int *stop;
+};
+
+static void *run_pool(void *arg)
+{
+	struct sim_run *run = arg;
+
+	pool_run(run->panels, run->npanels, run->workers, count_step, run->stop);
+	return NULL;
+}
+
+static int run_panels(int n, int workers)
+{
+	static struct panel panel[SIM_MAX_PANELS];
+	static struct sim_io io[SIM_MAX_PANELS];
+	struct panel *panels[SIM_MAX_PANELS];
+	struct multiplex mux;
+	struct sim_run run;
+	pthread_t mux_thread, pool_thread;
+	clockid_t mux_clock;
+	double wall, cpu, mux_cpu, mean, var;
+	uint64_t frames, sum, lit;
+	double sumsq;
+	long steps;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		memset(&panel[i], 0, sizeof panel[i]);
+		panel[i].id = i;
+		panel[i].quiet = 1;
+		panel[i].backend = &sim_backend;
+		panel[i].io = &io[i];
+		// register switches down for the shortest delay, mode in DF/IF,
+		// no buttons pressed
+		io[i].switches[0] = 0;
+		io[i].switches[1] = sim_modes[i % 8] << 6 | 077;
+		io[i].switches[2] = 07777;
+		panels[i] = &panel[i];
+	}
+
+	memset(&mux, 0, sizeof mux);
+	mux.panels = panels;
+	mux.npanels = n;
+	mux.terminate = &sim_stop;
+	run.panels = panels;
+	run.npanels = n;
+	run.workers = workers;
+	run.stop = &sim_stop;
+	sim_stop = 0;
+	sim_steps = 0;
+
+	if (pthread_create(&mux_thread, NULL, blink, &mux))
+		return -1;
+	usleep(50000);			// let the switch rows be read once
+	if (pthread_create(&pool_thread, NULL, run_pool, &run))
+	{
+		sim_stop = 1;
+		pthread_join(mux_thread, NULL);
+		return -1;
+	}
+	sleep(1);			// settle
+
+	// measure from here on
+	frames = mux.frames;
+	sum = mux.period_sum;
+	sumsq = mux.period_sumsq;
+	mux.period_max = 0;
+	mux.period_min = 0;
+	steps = sim_steps;
+	pthread_getcpuclockid(mux_thread, &mux_clock);
+	mux_cpu = delay_sec(mux_clock);
+	cpu = delay_sec(CLOCK_PROCESS_CPUTIME_ID);
+	wall = delay_sec(CLOCK_MONOTONIC);
+
+	sleep(SIM_SECONDS);
+
+	mux_cpu = delay_sec(mux_clock) - mux_cpu;
+	cpu = delay_sec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+	wall = delay_sec(CLOCK_MONOTONIC) - wall;
+	frames = mux.frames - frames;
+	sum = mux.period_sum - sum;
+	sumsq = mux.period_sumsq - sumsq;
+	steps = sim_steps - steps;
+
+	sim_stop = 1;
+	pthread_join(pool_thread, NULL);
+	pthread_join(mux_thread, NULL);
+
+	// every panel must have been lit as often as the others
+	lit = io[0].lit[0];
+	for (i = 1; i < n; i++)
+		if (io[i].lit[0] != lit || io[i].lit[7] != lit)
+		{
+			fprintf(stderr, "panels: panel %d was refreshed %llu times, panel 0 %llu\n",
+				i, (unsigned long long)io[i].lit[0], (unsigned long long)lit);
+			return -1;
+		}
+
+	mean = frames ? (double)sum / frames : 0.0;
+	var = frames ? sumsq / frames - mean * mean : 0.0;
+	printf("%6d %7d %9.1f %8.1f %8.1f %7.1f %8.1f %8.2f%% %8.2f%% %8.0f\n",
+	       n, workers, frames / wall, mux.period_min / 1000.0, mean / 1000,
+	       (var > 0 ? sqrt(var) : 0) / 1000, mux.period_max / 1000.0, 100 * mux_cpu / wall, 100 * (cpu - mux_cpu) / wall,
+	       steps / wall);
+	return 0;
+}
+
+int sim_bench(long (*step)(struct panel *p))
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n, workers;
+
+	sim_step = step;
+	printf("panels: %d s per run, modes cycle normal snake dim clock life sysload test sleep\n",
+	       SIM_SECONDS);
+	printf("panels workers  refresh  period us (min mean std max)      mux CPU  mode CPU  steps/s\n");
+	for (n = 1; n <= SIM_MAX_PANELS; n *= 2)
+	{
+		workers = n < ncpu ? n : ncpu;
+		if (workers > 4)
+			workers = 4;
+		if (workers < 1)
+			workers = 1;
+		if (run_panels(n, workers))
+			return -1;
+	}
+	return 0;
+}
+
+
+// PART 3 - parking ----------------------------------------------------
+
+// Wait up to a second for the multiplexer to park.  Returns 0 if it did.
+static int wait_parked(struct multiplex *mux)
+{
+	int i;
+
+	for (i = 0; i < 10000; i++)
+	{
+		if (__atomic_load_n(&mux->parked, __ATOMIC_SEQ_CST))
+			return 0;
+		usleep(100);
+	}
+	fprintf(stderr, "park: the multiplexer did not park\n");
+	return -1;
+}
+
+// Mux CPU in percent and switch scans per second over one second
+static void mux_load(pthread_t thread, struct sim_io *io, double *cpu, double *scans)
+{
+	clockid_t clock;
+	double c, w;
+	uint64_t s;
+
+	pthread_getcpuclockid(thread, &clock);
+	c = delay_sec(clock);
+	w = delay_sec(CLOCK_MONOTONIC);
+	s = io->scans;
+	sleep(1);
+	w = delay_sec(CLOCK_MONOTONIC) - w;
+	*cpu = 100 * (delay_sec(clock) - c) / w;
+	*scans = (io->scans - s) / w;
+}
+
+int park_bench(long (*step)(struct panel *p))
+{
+	static struct panel panel;
+	static struct sim_io io;
+	static volatile int pool_stop;
+	struct panel *panels[1] = { &panel };
+	struct multiplex mux;
+	struct sim_run run = { panels, 1, 1, &pool_stop };
+	pthread_t mux_thread, pool_thread;
+	double lit_cpu, lit_scans, dark_cpu, dark_scans;
+	uint64_t start, t, wake_sum = 0, wake_max = 0, sw_sum = 0, sw_max = 0;
+	uint32_t wakes;
+	long steps;
+	int i, r;
+
+	memset(&panel, 0, sizeof panel);
+	panel.quiet = 1;
+	panel.backend = &sim_backend;
+	panel.io = &io;
+	panel.ledstatus[0] = 1;
+
+	memset(&mux, 0, sizeof mux);
+	mux.panels = panels;
+	mux.npanels = 1;
+	mux.terminate = &sim_stop;
+	sim_stop = 0;
+	if (pthread_create(&mux_thread, NULL, blink, &mux))
+		return -1;
+	usleep(200000);			// calibration
+
+	mux_load(mux_thread, &io, &lit_cpu, &lit_scans);
+
+	// the dark mode (DF 3, IF 7, no buttons) stepped as usual: once it
+	// has blanked the panel, none of its frames may wake the multiplexer
+	io.switches[1] = 037 << 6 | 077;
+	io.switches[2] = 07777;
+	sim_step = step;
+	sim_steps = 0;
+	pool_stop = 0;
+	if (pthread_create(&pool_thread, NULL, run_pool, &run))
+		pool_stop = 1;
+	else if (wait_parked(&mux))
+	{
+		pool_stop = 1;
+		pthread_join(pool_thread, NULL);
+	}
+	if (pool_stop)
+	{
+		sim_stop = 1;
+		pthread_join(mux_thread, NULL);
+		return -1;
+	}
+	wakes = __atomic_load_n(&mux.wake, __ATOMIC_SEQ_CST);
+	steps = sim_steps;
+	mux_load(mux_thread, &io, &dark_cpu, &dark_scans);
+	wakes = __atomic_load_n(&mux.wake, __ATOMIC_SEQ_CST) - wakes;
+	steps = sim_steps - steps;
+	pool_stop = 1;
+	pthread_join(pool_thread, NULL);
+
+	for (i = 0; i < SIM_WAKES; i++)
+	{
+		// a frame is published: how long until its first row is lit
+		io.lit_at = 0;
+		start = delay_now();
+		for (r = 0; r < 8; r++)
+			panel.ledstatus[r] = 07777;
+		multiplex_wake(&panel);
+		while (!io.lit_at)
+			usleep(10);
+		t = io.lit_at - start;
+		wake_sum += t;
+		if (t > wake_max)
+			wake_max = t;
+
+		// blank it again
+		for (r = 0; r < 8; r++)
+			panel.ledstatus[r] = 0;
+		if (wait_parked(&mux))
+		{
+			sim_stop = 1;
+			pthread_join(mux_thread, NULL);
+			return -1;
+		}
+
+		// a switch flipped on the dark panel at any time in the poll
+		// interval: found by the next poll
+		usleep(rand() % (1000000 / MULTIPLEX_POLL_HZ));
+		io.switches[0] ^= 1;
+		start = delay_now();
+		while ((panel.switchstatus[0] & 1) != (io.switches[0] & 1))
+			usleep(50);
+		t = delay_now() - start;
+		sw_sum += t;
+		if (t > sw_max)
+			sw_max = t;
+	}
+
+	sim_stop = 1;
+	pthread_join(mux_thread, NULL);
+
+	printf("park: refreshing  mux CPU %5.2f%%, %6.0f switch scans/s, period %.0f us\n",
+	       lit_cpu, lit_scans, mux.period_min / 1000.0);
+	printf("park: dark mode   mux CPU %5.2f%%, %6.0f switch scans/s, %ld steps, %u wakes\n",
+	       dark_cpu, dark_scans, steps, wakes);
+	printf("park: wake        frame lit after %.1f us mean, %.1f us worst (%d frames)\n",
+	       wake_sum / 1000.0 / SIM_WAKES, wake_max / 1000.0, SIM_WAKES);
+	printf("park: switch      read after %.1f ms mean, %.1f ms worst (%d flips while dark)\n",
+	       sw_sum / 1e6 / SIM_WAKES, sw_max / 1e6, SIM_WAKES);
+	return 0;
+}
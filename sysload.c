@@ -0,0 +1,453 @@
+/*
+ * sysload.c: system load sampler for the 100 mode
+ *
+ * Every /proc file is opened once.  A sample re-reads each of them with a
+ * single pread() at offset 0 into a fixed buffer (which makes the kernel
+ * regenerate the contents) and walks the text with a small scanner that
+ * never allocates or copies.  One sample is five syscalls plus a few
+ * microseconds of parsing, cheap enough to run at 50Hz on a busy Pi.
+ *
+ * Buffers are large enough for the lines we use on boards with up to
+ * SYSLOAD_MAX_CPUS CPUs; anything past the end of a buffer is ignored.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sysload.h"
+#include "delay.h"
+#include "log.h"
+
+enum { F_STAT, F_MEMINFO, F_DISKSTATS, F_NETDEV, F_LOADAVG, F_COUNT };
+
+static const char *const proc_path[F_COUNT] = {
+	"/proc/stat", "/proc/meminfo", "/proc/diskstats", "/proc/net/dev", "/proc/loadavg"
+};
+
+static struct {
+	int  fd[F_COUNT];
+	char buf[F_COUNT][8192];
+	int  len[F_COUNT];
+} proc = { .fd = { -1, -1, -1, -1, -1 } };
+
+// Counters of the previous sample, rates are computed from the difference
+static struct {
+	unsigned long long busy[SYSLOAD_MAX_CPUS + 1];	// last entry: all CPUs
+	unsigned long long total[SYSLOAD_MAX_CPUS + 1];
+	unsigned long long disk_sectors;
+	unsigned long long net_bytes;
+	struct timespec when;
+} prev;
+
+// Panels sampling within SYSLOAD_SHARE_NS of each other share one sample
+#define SYSLOAD_SHARE_NS	20000000L
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sysload last;
+
+
+// PART 1 - scanner ----------------------------------------------------
+
+struct scan {
+	const char *p;
+	const char *end;
+};
+
+static int is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Move to the start of the next line, 0 at the end of the buffer
+static int scan_line(struct scan *s)
+{
+	while (s->p < s->end && *s->p != '\n')
+		s->p++;
+	if (s->p < s->end)
+		s->p++;
+	return s->p < s->end;
+}
+
+// Consume the word w (after blanks) if the line continues with it
+static int scan_word(struct scan *s, const char *w)
+{
+	const char *p = s->p;
+
+	while (p < s->end && is_space(*p))
+		p++;
+	while (*w && p < s->end && *p == *w)
+	{
+		p++;
+		w++;
+	}
+	if (*w)
+		return 0;
+	s->p = p;
+	return 1;
+}
+
+// Next unsigned number on the line, skipping blanks and ':'
+static unsigned long long scan_ull(struct scan *s)
+{
+	unsigned long long v = 0;
+
+	while (s->p < s->end && (is_space(*s->p) || *s->p == ':'))
+		s->p++;
+	while (s->p < s->end && is_digit(*s->p))
+		v = v * 10 + (*s->p++ - '0');
+	return v;
+}
+
+// Next name on the line (up to a blank or ':'), not terminated
+static int scan_name(struct scan *s, const char **name)
+{
+	while (s->p < s->end && is_space(*s->p))
+		s->p++;
+	*name = s->p;
+	while (s->p < s->end && !is_space(*s->p) && *s->p != ':' && *s->p != '\n')
+		s->p++;
+	return s->p - *name;
+}
+
+static void scan_begin(struct scan *s, int f)
+{
+	s->p = proc.buf[f];
+	s->end = proc.buf[f] + proc.len[f];
+}
+
+
+// PART 2 - parsers ----------------------------------------------------
+
+static int percent(unsigned long long part, unsigned long long whole)
+{
+	return whole ? (int)(part * 100 / whole) : 0;
+}
+
+// cpu lines: user nice system idle iowait irq softirq steal
+static void parse_stat(struct sysload *out)
+{
+	struct scan s;
+	unsigned long long v, busy, total;
+	int cpu, i;
+
+	out->ncpu = 0;
+	scan_begin(&s, F_STAT);
+	do
+	{
+		if (!scan_word(&s, "cpu"))
+			break;			// cpu lines come first
+		if (s.p < s.end && is_digit(*s.p))
+		{
+			cpu = (int)scan_ull(&s);
+			if (cpu >= SYSLOAD_MAX_CPUS)
+				continue;
+		}
+		else
+			cpu = SYSLOAD_MAX_CPUS;
+
+		busy = total = 0;
+		for (i = 0; i < 8; i++)
+		{
+			v = scan_ull(&s);
+			total += v;
+			if (i != 3 && i != 4)	// idle and iowait
+				busy += v;
+		}
+
+		v = percent(busy - prev.busy[cpu], total - prev.total[cpu]);
+		prev.busy[cpu] = busy;
+		prev.total[cpu] = total;
+		if (cpu == SYSLOAD_MAX_CPUS)
+			out->cpu_total = v;
+		else
+		{
+			out->cpu[cpu] = v;
+			if (cpu >= out->ncpu)
+				out->ncpu = cpu + 1;
+		}
+	} while (scan_line(&s));
+}
+
+static void parse_meminfo(struct sysload *out)
+{
+	struct scan s;
+	unsigned long long total = 0, avail = 0;
+
+	scan_begin(&s, F_MEMINFO);
+	do
+	{
+		if (scan_word(&s, "MemTotal:"))
+			total = scan_ull(&s);
+		else if (scan_word(&s, "MemAvailable:"))
+			avail = scan_ull(&s);
+	} while ((!total || !avail) && scan_line(&s));
+	out->mem = total > avail ? percent(total - avail, total) : 0;
+}
+
+// Whole disks only: partitions would count the same traffic twice
+static int is_disk(const char *name, int len)
+{
+	if (len >= 4 && (!memcmp(name, "loop", 4) || !memcmp(name, "zram", 4)))
+		return 0;
+	if (len >= 3 && (!memcmp(name, "ram", 3) || !memcmp(name, "dm-", 3)))
+		return 0;
+	if ((len >= 6 && !memcmp(name, "mmcblk", 6)) || (len >= 4 && !memcmp(name, "nvme", 4)))
+	{
+		while (len > 0 && is_digit(name[len - 1]))
+			len--;
+		return name[len - 1] != 'p';	// mmcblk0p1, nvme0n1p1
+	}
+	return !is_digit(name[len - 1]);	// sda1
+}
+
+// major minor name reads merged sectors ms writes merged sectors ...
+static unsigned long long parse_diskstats(void)
+{
+	struct scan s;
+	const char *name;
+	unsigned long long sectors = 0;
+	int len;
+
+	scan_begin(&s, F_DISKSTATS);
+	do
+	{
+		scan_ull(&s);
+		scan_ull(&s);
+		if ((len = scan_name(&s, &name)) == 0 || !is_disk(name, len))
+			continue;
+		scan_ull(&s);
+		scan_ull(&s);
+		sectors += scan_ull(&s);
+		scan_ull(&s);
+		scan_ull(&s);
+		scan_ull(&s);
+		sectors += scan_ull(&s);
+	} while (scan_line(&s));
+	return sectors;
+}
+
+// two header lines, then "name: rx_bytes 7 more ... tx_bytes ..."
+static unsigned long long parse_netdev(void)
+{
+	struct scan s;
+	const char *name;
+	unsigned long long bytes = 0;
+	int len, i;
+
+	scan_begin(&s, F_NETDEV);
+	if (!scan_line(&s) || !scan_line(&s))
+		return 0;
+	do
+	{
+		len = scan_name(&s, &name);
+		if (len == 0 || (len == 2 && !memcmp(name, "lo", 2)))
+			continue;
+		bytes += scan_ull(&s);
+		for (i = 0; i < 7; i++)
+			scan_ull(&s);
+		bytes += scan_ull(&s);
+	} while (scan_line(&s));
+	return bytes;
+}
+
+static void parse_loadavg(struct sysload *out)
+{
+	struct scan s;
+
+	scan_begin(&s, F_LOADAVG);
+	out->load100 = scan_ull(&s) * 100;
+	if (s.p + 2 < s.end && *s.p == '.')
+	{
+		s.p++;
+		out->load100 += scan_ull(&s) % 100;	// always two decimals
+	}
+}
+
+
+// PART 3 - sampling ---------------------------------------------------
+
+// Bar of n LEDs out of 12, growing from the left
+static uint16_t bar(int n)
+{
+	if (n < 0)
+		n = 0;
+	if (n > 12)
+		n = 12;
+	return ((1 << n) - 1) << (12 - n);
+}
+
+// LEDs for a rate on a log scale: one per doubling from 16KB/s (32MB/s = 12)
+static int log_leds(uint32_t kbs)
+{
+	int n = 0;
+
+	for (kbs >>= 3; kbs > 1; kbs >>= 1)
+		n++;
+	return n;
+}
+
+static void map_bars(struct sysload *out)
+{
+	uint16_t heat = 0;
+	int i, w, g, busiest;
+
+	// Program Counter: a short bar per CPU if they fit, else a bit per
+	// group of CPUs, lit when the busiest CPU of the group is busy
+	if (out->ncpu > 0 && out->ncpu <= 12)
+	{
+		w = 12 / out->ncpu;
+		for (i = 0; i < out->ncpu; i++)
+			heat |= (bar((out->cpu[i] * w + 50) / 100) >> (12 - w)) << (12 - w * (i + 1));
+	}
+	else
+		for (g = 0; g < 12; g++)
+		{
+			busiest = 0;
+			for (i = g * out->ncpu / 12; i < (g + 1) * out->ncpu / 12; i++)
+				if (out->cpu[i] > busiest)
+					busiest = out->cpu[i];
+			if (busiest >= 50)
+				heat |= 1 << (11 - g);
+		}
+	out->bars[0] = heat;
+
+	out->bars[1] = bar((out->mem * 12 + 50) / 100);
+	out->bars[2] = bar(log_leds(out->disk_kbs));
+	out->bars[3] = bar(log_leds(out->net_kbs));
+	// full bar at a load of two per CPU
+	out->bars[4] = bar(out->ncpu ? out->load100 * 6 / (out->ncpu * 100) : 0);
+}
+
+static int read_all(void)
+{
+	int f;
+
+	for (f = 0; f < F_COUNT; f++)
+	{
+		proc.len[f] = proc.fd[f] < 0 ? 0 : pread(proc.fd[f], proc.buf[f], sizeof proc.buf[f], 0);
+		if (proc.len[f] < 0)
+			proc.len[f] = 0;
+	}
+	return proc.len[F_STAT] > 0 ? 0 : -1;
+}
+
+static void parse_all(struct sysload *out, double dt)
+{
+	unsigned long long sectors, bytes;
+
+	parse_stat(out);
+	parse_meminfo(out);
+	parse_loadavg(out);
+
+	sectors = parse_diskstats();
+	bytes = parse_netdev();
+	if (dt > 0.0)
+	{
+		out->disk_kbs = (uint32_t)((sectors - prev.disk_sectors) / 2 / dt);
+		out->net_kbs = (uint32_t)((bytes - prev.net_bytes) / 1024 / dt);
+	}
+	prev.disk_sectors = sectors;
+	prev.net_bytes = bytes;
+
+	map_bars(out);
+}
+
+// Read and parse every file, the caller holds sample_lock
+static int take_sample(struct sysload *out)
+{
+	struct timespec now;
+	double dt;
+
+	if (read_all())
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	dt = (now.tv_sec - prev.when.tv_sec) + (now.tv_nsec - prev.when.tv_nsec) / 1e9;
+	if (prev.when.tv_sec == 0)
+		dt = 0.0;
+	prev.when = now;
+	parse_all(out, dt);
+	last = *out;
+	return 0;
+}
+
+int sysload_sample(struct sysload *out)
+{
+	struct timespec now;
+	long age;
+	int ret = 0;
+
+	pthread_mutex_lock(&sample_lock);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age = (now.tv_sec - prev.when.tv_sec) * 1000000000L + (now.tv_nsec - prev.when.tv_nsec);
+	if (prev.when.tv_sec != 0 && age < SYSLOAD_SHARE_NS)
+		*out = last;
+	else
+		ret = take_sample(out);
+	pthread_mutex_unlock(&sample_lock);
+	return ret;
+}
+
+int sysload_open(void)
+{
+	struct sysload first;
+	int f;
+
+	for (f = 0; f < F_COUNT; f++)
+		if (proc.fd[f] < 0 && (proc.fd[f] = open(proc_path[f], O_RDONLY)) < 0)
+			log_warn("%s: %s", proc_path[f], strerror(errno));
+	if (proc.fd[F_STAT] < 0)
+		return -1;
+	return sysload_sample(&first);
+}
+
+
+// PART 4 - benchmark --------------------------------------------------
+
+int sysload_bench(void)
+{
+	struct sysload load;
+	double start, parse, sample;
+	long n, parses = 0, samples = 0;
+	int f, bytes = 0;
+
+	if (sysload_open())
+		return -1;
+
+	// parse only, on the buffers of the last read
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 1000; n++)
+			parse_all(&load, 0.02);
+		parses += n;
+	} while ((parse = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+
+	// full sample: pread of every file plus parse
+	start = delay_sec(CLOCK_THREAD_CPUTIME_ID);
+	do
+	{
+		for (n = 0; n < 100; n++)
+			take_sample(&load);
+		samples += n;
+	} while ((sample = delay_sec(CLOCK_THREAD_CPUTIME_ID) - start) < 1.0);
+
+	for (f = 0; f < F_COUNT; f++)
+		bytes += proc.len[f];
+	printf("sysload: %d CPUs, %d bytes of /proc text per sample\n", load.ncpu, bytes);
+	printf("sysload: parse  %.2f us/sample\n", 1e6 * parse / parses);
+	printf("sysload: sample %.2f us/sample (pread + parse)\n", 1e6 * sample / samples);
+	printf("sysload: at 50Hz that is %.3f%% of one CPU\n", 100.0 * 50 * sample / samples);
+	printf("sysload: cpu %d%%  mem %d%%  disk %u KB/s  net %u KB/s  load %u.%02u\n",
+	       load.cpu_total, load.mem, load.disk_kbs, load.net_kbs,
+	       load.load100 / 100, load.load100 % 100);
+	return 0;
+}
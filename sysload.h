@@ -0,0 +1,36 @@
+/*
+ * sysload.h: system load sampler for the 100 mode
+ *
+ * Keeps the /proc files open, re-reads them with pread() into fixed
+ * buffers and parses them without allocating.
+ */
+
+#ifndef SYSLOAD_H
+#define SYSLOAD_H
+
+#include <stdint.h>
+
+#define SYSLOAD_MAX_CPUS	64
+
+struct sysload {
+	int      ncpu;				// highest CPU number seen + 1
+	uint8_t  cpu[SYSLOAD_MAX_CPUS];		// busy percent per CPU
+	uint8_t  cpu_total;			// busy percent of all CPUs
+	uint8_t  mem;				// percent of memory not available
+	uint32_t disk_kbs;			// KB/s read + written on whole disks
+	uint32_t net_kbs;			// KB/s received + sent, except lo
+	uint32_t load100;			// 1 minute load average x 100
+	uint16_t bars[5];			// CPU heat, memory, disk, network, load
+};
+
+// Open the /proc files and take the first sample.  Returns 0 on success.
+int sysload_open(void);
+
+// Take a sample.  Rates and percentages are relative to the previous call;
+// callers within 20ms of it (other panels) get a copy of the same sample.
+int sysload_sample(struct sysload *out);
+
+// Benchmark the read and parse path, report microseconds per sample
+int sysload_bench(void);
+
+#endif